@@ -0,0 +1,10 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+// Number of global operator new calls made so far by the process. Defined in alloc_counter.cpp,
+// which replaces the global allocation functions, so only targets linking it can use this.
+size_t allocation_count();
+
+#endif // ALLOC_COUNTER_HPP
@@ -0,0 +1,460 @@
+#include <sys/resource.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "alloc_counter.hpp"
+#include "registry.hpp"
+#include "scene.hpp"
+#include "simulator.hpp"
+
+#ifndef FLUID_DEFAULT_INPUT
+#define FLUID_DEFAULT_INPUT "input.txt"
+#endif
+
+// Headless end-to-end measurement of Simulator, frame output off.
+//
+//   bench [--mode=suite|layouts|threads] [--input=path] [--families=input,tall,wide,grid]
+//         [--sizes=64,256,1024,4096] [--scales=1,2,4,8] [--ticks=count] [--threads=1,2,4]
+//         [--format=csv|json] [--output=path] [--baseline=path] [--tolerance=0.1]
+//
+// suite    every type of TYPES on every scene family: the stock input, and for each size a
+//          tall column (size x size/16), a wide basin (size/16 x size) and a square grid with
+//          wall posts, all three starting as a dam break so the fluid keeps moving
+// layouts  the grid memory layouts with FIXED(32,16) on the stock scene upscaled by --scales,
+//          plus the default layout with velocity_flow narrowed to FAST_FIXED(16,8)
+// threads  the default layout with the thread pool and the parallel move phase (philox random
+//          numbers) on the upscaled stock scene, one run per thread count; --threads implies it
+//
+// Every run is one row of
+// scene,n,m,type,layout,ticks,seconds,ticks_per_sec,ns_per_cell_tick,peak_rss_kb,allocations,flow_rounds,flow_visits
+// where ns_per_cell_tick counts all n * m cells, peak_rss_kb is the resident set high-water
+// mark of the run, allocations counts heap allocations made by the ticks themselves (expected
+// 0) and flow_rounds and flow_visits are per-tick averages of the flow phase work.
+//
+// --baseline compares ns_per_cell_tick with the CSV of an earlier run, matching rows by scene,
+// type, layout and ticks, and exits with 2 if any run got slower by more than --tolerance.
+
+namespace {
+  enum class BenchMode {
+    Suite,
+    Layouts,
+    Threads,
+  };
+
+  struct BenchOptions {
+    BenchMode mode = BenchMode::Suite;
+    std::string input = FLUID_DEFAULT_INPUT;
+    std::vector<std::string> families{"input", "tall", "wide", "grid"};
+    std::vector<int> sizes{64, 256, 1024, 4096};
+    std::vector<int> scales{1, 2, 4, 8};
+    size_t ticks = 10;
+    std::vector<size_t> threads{1, 2, 4};
+    bool json = false;
+    std::string output;
+    std::string baseline;
+    double tolerance = 0.1;
+  };
+
+  struct BenchResult {
+    std::string scene;
+    int n, m;
+    std::string type, layout;
+    size_t ticks;
+    double seconds;
+    size_t peak_rss_kb;
+    size_t allocations;
+    double flow_rounds, flow_visits;
+
+    double ns_per_cell_tick() const {
+      return seconds * 1e9 / (double(n) * m * ticks);
+    }
+
+    std::string key() const {
+      return scene + "/" + type + "/" + layout + "/" + std::to_string(ticks);
+    }
+  };
+
+  const char *csv_header =
+      "scene,n,m,type,layout,ticks,seconds,ticks_per_sec,ns_per_cell_tick,peak_rss_kb,allocations,flow_rounds,"
+      "flow_visits";
+
+  // Type names like FIXED(32,16) hold commas
+  std::string csv_field(const std::string &value) {
+    return value.find(',') == std::string::npos ? value : '"' + value + '"';
+  }
+
+  std::vector<std::string> split_csv(const std::string &line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (char c : line) {
+      if (c == '"') {
+        quoted = !quoted;
+      } else if (c == ',' && !quoted) {
+        fields.emplace_back();
+      } else {
+        fields.back() += c;
+      }
+    }
+    return fields;
+  }
+
+  // Starts a new resident set high-water mark, where the kernel allows it
+  void reset_peak_rss() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+  }
+
+  size_t peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+      if (line.rfind("VmHWM:", 0) == 0) {
+        return std::stoull(line.substr(6));
+      }
+    }
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  // Every cell of the scene becomes a factor x factor block
+  Scene upscale(const Scene &scene, int factor) {
+    Scene scaled = scene;
+    scaled.n = scene.n * factor;
+    scaled.m = scene.m * factor;
+    scaled.field.assign(scaled.n, std::string(scaled.m, ' '));
+    for (int x = 0; x < scaled.n; x++) {
+      for (int y = 0; y < scaled.m; y++) {
+        scaled.field[x][y] = scene.field[x / factor][y / factor];
+      }
+    }
+    return scaled;
+  }
+
+  // An n x m box with the constants of `like`, cell(x, y) decides the inside cells
+  template<typename Cell>
+  Scene make_scene(const Scene &like, int n, int m, Cell &&cell) {
+    Scene scene;
+    scene.n = n;
+    scene.m = m;
+    scene.g = like.g;
+    scene.rho = like.rho;
+    scene.damping = like.damping;
+    scene.field.assign(n, std::string(m, '#'));
+    for (int x = 1; x + 1 < n; x++) {
+      for (int y = 1; y + 1 < m; y++) {
+        scene.field[x][y] = cell(x, y);
+      }
+    }
+    return scene;
+  }
+
+  // Scenes of one generated family at one size, "input" for the stock scene
+  Scene family_scene(const std::string &family, int size, const Scene &stock) {
+    int thin = std::max(size / 16, 8);
+    if (family == "tall") {
+      // water column over air
+      return make_scene(stock, size, thin, [&](int x, int) { return x < size / 2 ? '.' : ' '; });
+    }
+    if (family == "wide") {
+      // basin with the water held on the left
+      return make_scene(stock, thin, size, [&](int, int y) { return y < size / 2 ? '.' : ' '; });
+    }
+    if (family == "grid") {
+      // square with a lattice of one-cell posts, water in the left half
+      return make_scene(stock, size, size, [&](int x, int y) {
+        return x % 16 == 8 && y % 16 == 8 ? '#' : y < size / 2 ? '.' : ' ';
+      });
+    }
+    throw std::invalid_argument("Unknown scene family " + family);
+  }
+
+  class Report {
+    public:
+      explicit Report(const BenchOptions &options) : options(options) {
+        if (!options.output.empty()) {
+          file.open(options.output);
+          if (!file) {
+            throw std::runtime_error("Failed to open " + options.output);
+          }
+        }
+        if (!options.json) {
+          out() << csv_header << std::endl;
+        }
+      }
+
+      // CSV rows go out as soon as a run is done, JSON once all of them are
+      void add(const BenchResult &result) {
+        results.push_back(result);
+        if (!options.json) {
+          out() << csv_field(result.scene) << "," << result.n << "," << result.m << "," << csv_field(result.type)
+              << "," << csv_field(result.layout) << "," << result.ticks << "," << result.seconds << ","
+              << result.ticks / result.seconds << "," << result.ns_per_cell_tick() << "," << result.peak_rss_kb << ","
+              << result.allocations << "," << result.flow_rounds << "," << result.flow_visits << std::endl;
+        }
+      }
+
+      void finish() {
+        if (!options.json) {
+          return;
+        }
+        out() << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+          const auto &result = results[i];
+          out() << "  {\"scene\": \"" << result.scene << "\", \"n\": " << result.n << ", \"m\": " << result.m
+              << ", \"type\": \"" << result.type << "\", \"layout\": \"" << result.layout << "\", \"ticks\": "
+              << result.ticks << ", \"seconds\": " << result.seconds << ", \"ticks_per_sec\": "
+              << result.ticks / result.seconds << ", \"ns_per_cell_tick\": " << result.ns_per_cell_tick()
+              << ", \"peak_rss_kb\": " << result.peak_rss_kb << ", \"allocations\": " << result.allocations
+              << ", \"flow_rounds\": " << result.flow_rounds << ", \"flow_visits\": " << result.flow_visits << "}"
+              << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out() << "]" << std::endl;
+      }
+
+      // Prints every run that is slower than in the baseline CSV by more than the tolerance,
+      // false if there was one
+      bool compare_baseline() const {
+        std::ifstream input(options.baseline);
+        std::string line;
+        if (!input || !std::getline(input, line)) {
+          throw std::runtime_error("Failed to read baseline " + options.baseline);
+        }
+        std::unordered_map<std::string, size_t> column;
+        auto header = split_csv(line);
+        for (size_t i = 0; i < header.size(); i++) {
+          column[header[i]] = i;
+        }
+        for (const char *name : {"scene", "type", "layout", "ticks", "ns_per_cell_tick"}) {
+          if (!column.contains(name)) {
+            throw std::runtime_error(options.baseline + " has no " + name + " column");
+          }
+        }
+        std::unordered_map<std::string, double> baseline;
+        while (std::getline(input, line)) {
+          auto fields = split_csv(line);
+          if (fields.size() != header.size()) {
+            continue;
+          }
+          baseline[fields[column["scene"]] + "/" + fields[column["type"]] + "/" + fields[column["layout"]] + "/" +
+                   fields[column["ticks"]]] = std::stod(fields[column["ns_per_cell_tick"]]);
+        }
+
+        size_t compared = 0, regressions = 0;
+        for (const auto &result : results) {
+          auto it = baseline.find(result.key());
+          if (it == baseline.end()) {
+            continue;
+          }
+          compared++;
+          double change = result.ns_per_cell_tick() / it->second - 1;
+          if (change > options.tolerance) {
+            regressions++;
+            std::cerr << "slower: " << result.key() << " " << it->second << " -> " << result.ns_per_cell_tick()
+                << " ns/cell-tick (+" << change * 100 << "%)\n";
+          }
+        }
+        std::cerr << compared << " runs compared with " << options.baseline << ", " << regressions
+            << " slower by more than " << options.tolerance * 100 << "%\n";
+        return regressions == 0;
+      }
+
+    private:
+      std::ostream &out() {
+        return options.output.empty() ? std::cout : file;
+      }
+
+      const BenchOptions &options;
+      std::ofstream file;
+      std::vector<BenchResult> results;
+  };
+
+  template<typename Sim, typename Setup>
+  void run(Report &report, const std::string &name, const std::string &type, const std::string &layout,
+           const Scene &scene, const BenchOptions &options, Setup &&setup) {
+    reset_peak_rss();
+    auto simulator = std::make_unique<Sim>(scene);
+    setup(*simulator);
+    size_t allocations = allocation_count();
+    size_t rounds = 0, visits = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (simulator->ticks_done() < options.ticks) {
+      simulator->step();
+      rounds += simulator->flow_stats().rounds;
+      visits += simulator->flow_stats().visited;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocations = allocation_count() - allocations;
+    report.add({
+      name, scene.n, scene.m, type, layout, options.ticks, seconds, peak_rss_kb(), allocations,
+      double(rounds) / options.ticks, double(visits) / options.ticks
+    });
+  }
+
+  template<typename Sim>
+  void run(Report &report, const std::string &name, const std::string &type, const std::string &layout,
+           const Scene &scene, const BenchOptions &options) {
+    run<Sim>(report, name, type, layout, scene, options, [](Sim &) {});
+  }
+
+  template<typename... Types>
+  void run_types(Report &report, const std::string &name, const Scene &scene, const BenchOptions &options,
+                 TypeList<Types...>) {
+    (run<Simulator<Types, Types, Types> >(report, name, TypeName<Types>::get(), "default", scene, options), ...);
+  }
+
+  template<typename Type>
+  void run_layouts(Report &report, const std::string &name, const Scene &scene, const BenchOptions &options) {
+    constexpr GridLayout aos{false, VelocityLayout::AoS}, aos_padded{true, VelocityLayout::AoS};
+    constexpr GridLayout soa{false, VelocityLayout::SoA}, soa_padded{true, VelocityLayout::SoA};
+    std::string type = TypeName<Type>::get();
+    run<Simulator<Type, Type, Type, 0, 0, aos> >(report, name, type, "aos", scene, options);
+    run<Simulator<Type, Type, Type, 0, 0, aos_padded> >(report, name, type, "aos-padded", scene, options);
+    run<Simulator<Type, Type, Type, 0, 0, soa> >(report, name, type, "soa", scene, options);
+    run<Simulator<Type, Type, Type, 0, 0, soa_padded> >(report, name, type, "soa-padded", scene, options);
+    run<Simulator<Type, Type, FAST_FIXED(16, 8)> >(report, name, type, "flow-fast-fixed-16-8", scene, options);
+    if (scene.n == 36 && scene.m == 84) {
+      run<Simulator<Type, Type, Type, 36, 84> >(report, name, type, "static-36x84", scene, options);
+    }
+  }
+
+  template<typename Type>
+  void run_threads(Report &report, const std::string &name, const Scene &scene, const BenchOptions &options) {
+    using Sim = Simulator<Type, Type, Type>;
+    for (size_t threads : options.threads) {
+      ThreadPool pool(threads);
+      run<Sim>(report, name, TypeName<Type>::get(), "threads-" + std::to_string(threads), scene, options,
+               [&](Sim &simulator) {
+                 simulator.set_rng(PhiloxRng(1337));
+                 simulator.set_thread_pool(&pool);
+                 simulator.set_parallel_move(true);
+               });
+    }
+  }
+
+  template<typename Item, typename Parse>
+  std::vector<Item> parse_list(const std::string &value, Parse &&parse) {
+    std::vector<Item> items;
+    std::istringstream list(value);
+    for (std::string item; std::getline(list, item, ',');) {
+      items.push_back(parse(item));
+    }
+    return items;
+  }
+
+  bool parse_bench_options(int argc, char **argv, BenchOptions &options) {
+    auto to_int = [](const std::string &item) { return std::stoi(item); };
+    try {
+      for (int i = 1; i < argc; i++) {
+        std::string arg_str = argv[i];
+        size_t eq_pos = arg_str.find('=');
+        std::string key = arg_str.substr(0, eq_pos);
+        std::string value = eq_pos == std::string::npos ? "" : arg_str.substr(eq_pos + 1);
+        if (key == "--mode") {
+          if (value == "suite") {
+            options.mode = BenchMode::Suite;
+          } else if (value == "layouts") {
+            options.mode = BenchMode::Layouts;
+          } else if (value == "threads") {
+            options.mode = BenchMode::Threads;
+          } else {
+            std::cerr << "--mode expects suite, layouts or threads\n";
+            return false;
+          }
+        } else if (key == "--input") {
+          options.input = value;
+        } else if (key == "--families") {
+          options.families = parse_list<std::string>(value, [](const std::string &item) { return item; });
+        } else if (key == "--sizes") {
+          options.sizes = parse_list<int>(value, to_int);
+        } else if (key == "--scales") {
+          options.scales = parse_list<int>(value, to_int);
+        } else if (key == "--ticks") {
+          options.ticks = std::stoull(value);
+        } else if (key == "--threads") {
+          options.threads = parse_list<size_t>(value, [](const std::string &item) { return std::stoull(item); });
+          options.mode = BenchMode::Threads;
+        } else if (key == "--format") {
+          if (value != "csv" && value != "json") {
+            std::cerr << "--format expects csv or json\n";
+            return false;
+          }
+          options.json = value == "json";
+        } else if (key == "--output") {
+          options.output = value;
+        } else if (key == "--baseline") {
+          options.baseline = value;
+        } else if (key == "--tolerance") {
+          options.tolerance = std::stod(value);
+        } else {
+          std::cerr << "Unknown argument " << key << "\n";
+          return false;
+        }
+      }
+    } catch (const std::logic_error &) {
+      std::cerr << "Bad numeric argument\n";
+      return false;
+    }
+    for (const auto &family : options.families) {
+      if (family != "input" && family != "tall" && family != "wide" && family != "grid") {
+        std::cerr << "Unknown scene family " << family << "\n";
+        return false;
+      }
+    }
+    for (int size : options.sizes) {
+      if (size < 8) {
+        std::cerr << "--sizes must be at least 8\n";
+        return false;
+      }
+    }
+    return options.ticks > 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!parse_bench_options(argc, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " [--mode=suite|layouts|threads] [--input=path]"
+        << " [--families=input,tall,wide,grid]\n"
+        << "  [--sizes=64,256,1024,4096] [--scales=1,2,4,8] [--ticks=count] [--threads=1,2,4]\n"
+        << "  [--format=csv|json] [--output=path] [--baseline=path] [--tolerance=0.1]\n";
+    return 1;
+  }
+
+  try {
+    Scene stock = load_scene(options.input);
+    Report report(options);
+    if (options.mode == BenchMode::Suite) {
+      for (const auto &family : options.families) {
+        if (family == "input") {
+          run_types(report, "input", stock, options, TypeList<TYPES>());
+          continue;
+        }
+        for (int size : options.sizes) {
+          run_types(report, family + "-" + std::to_string(size), family_scene(family, size, stock), options,
+                    TypeList<TYPES>());
+        }
+      }
+    } else {
+      for (int scale : options.scales) {
+        std::string name = "input-x" + std::to_string(scale);
+        if (options.mode == BenchMode::Layouts) {
+          run_layouts<Fixed<32, 16> >(report, name, upscale(stock, scale), options);
+        } else {
+          run_threads<Fixed<32, 16> >(report, name, upscale(stock, scale), options);
+        }
+      }
+    }
+    report.finish();
+    if (!options.baseline.empty() && !report.compare_baseline()) {
+      return 2;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
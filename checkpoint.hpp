@@ -0,0 +1,178 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mapped_file.hpp"
+#include "scene.hpp"
+
+// Binary Simulator checkpoint. A fixed header is followed by raw sections, each aligned to
+// 64 bytes and holding row-major cells without padding. Restoring is a single mmap and one
+// copy per layer, independent of the grid layout and size variant that wrote it.
+
+constexpr std::array<char, 8> checkpoint_magic{'F', 'L', 'U', 'I', 'D', 'C', 'P', '\0'};
+constexpr uint32_t checkpoint_version = 3;
+constexpr size_t checkpoint_alignment = 64;
+
+enum class CheckpointSection : uint32_t {
+  // g followed by rho[256] and damping[256], PType
+  Constants,
+  // n * m chars
+  Field,
+  // n * m PType
+  Pressure,
+  // n * m * 4 VType, directions in deltas order
+  Velocity,
+  // n * m int
+  LastUse,
+  // name of the random number policy followed by its textual state
+  Random,
+  Count,
+};
+
+struct CheckpointSectionEntry {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+};
+
+struct CheckpointHeader {
+  std::array<char, 8> magic = checkpoint_magic;
+  uint32_t version = checkpoint_version;
+  uint32_t n = 0;
+  uint32_t m = 0;
+  int32_t ut = 0;
+  uint64_t tick = 0;
+  // TypeName spellings, checked on restore
+  std::array<char, 32> p_type{};
+  std::array<char, 32> v_type{};
+  std::array<char, 32> v_flow_type{};
+  std::array<CheckpointSectionEntry, static_cast<size_t>(CheckpointSection::Count)> sections{};
+};
+
+inline void set_type_name(std::array<char, 32> &dst, const std::string &name) {
+  if (name.size() >= dst.size()) {
+    throw std::runtime_error("Type name too long for a checkpoint: " + name);
+  }
+  std::ranges::fill(dst, '\0');
+  std::ranges::copy(name, dst.begin());
+}
+
+// Writes into path + ".tmp" and renames over path on commit, so a crash never leaves a
+// truncated checkpoint behind
+class CheckpointWriter {
+  public:
+    explicit CheckpointWriter(std::string path) : path(std::move(path)), buffer(1 << 20) {
+      out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      out.open(this->path + ".tmp", std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        throw std::runtime_error("Failed to open " + this->path + ".tmp");
+      }
+      pad_to(sizeof(CheckpointHeader));
+    }
+
+    // write(out) must append exactly `size` bytes
+    template<typename Write>
+    void section(CheckpointSection id, size_t size, Write &&write) {
+      pad_to((position + checkpoint_alignment - 1) / checkpoint_alignment * checkpoint_alignment);
+      header.sections[static_cast<size_t>(id)] = {position, size};
+      write(out);
+      position += size;
+    }
+
+    template<typename Type>
+    void raw(CheckpointSection id, const Type *values, size_t count) {
+      section(id, count * sizeof(Type), [&](std::ostream &stream) {
+        stream.write(reinterpret_cast<const char *>(values), static_cast<std::streamsize>(count * sizeof(Type)));
+      });
+    }
+
+    void commit() {
+      out.seekp(0);
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      out.close();
+      if (!out) {
+        throw std::runtime_error("Failed to write " + path + ".tmp");
+      }
+      if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Failed to move checkpoint into " + path);
+      }
+    }
+
+    CheckpointHeader header;
+
+  private:
+    void pad_to(size_t offset) {
+      for (; position < offset; position++) {
+        out.put('\0');
+      }
+    }
+
+    std::string path;
+    std::vector<char> buffer;
+    std::ofstream out;
+    size_t position = 0;
+};
+
+class CheckpointReader {
+  public:
+    explicit CheckpointReader(const std::string &path) : path(path), file(path) {
+      if (file.size() < sizeof(CheckpointHeader)) {
+        throw std::runtime_error(path + " is not a checkpoint");
+      }
+      std::memcpy(&header, file.data(), sizeof(header));
+      if (header.magic != checkpoint_magic) {
+        throw std::runtime_error(path + " is not a checkpoint");
+      }
+      if (header.version != checkpoint_version) {
+        throw std::runtime_error(path + " has checkpoint version " + std::to_string(header.version) +
+                                 ", expected " + std::to_string(checkpoint_version));
+      }
+    }
+
+    std::string_view section(CheckpointSection id, size_t expected_size) const {
+      auto [offset, size] = header.sections[static_cast<size_t>(id)];
+      if (size != expected_size || offset + size > file.size()) {
+        throw std::runtime_error(path + ": damaged checkpoint section " + std::to_string(static_cast<int>(id)));
+      }
+      return {file.data() + offset, size};
+    }
+
+    std::string_view section(CheckpointSection id) const {
+      return section(id, header.sections[static_cast<size_t>(id)].size);
+    }
+
+    void check_type(const std::array<char, 32> &stored, const std::string &expected, const char *what) const {
+      if (std::string(stored.data()) != expected) {
+        throw std::runtime_error(path + " was written with " + what + "=" + stored.data() + ", not " + expected);
+      }
+    }
+
+    CheckpointHeader header;
+
+  private:
+    std::string path;
+    MappedFile file;
+};
+
+// Scene with the dimensions and field of a checkpoint, enough to construct the Simulator
+// that load_checkpoint() then restores exactly
+inline Scene checkpoint_scene(const std::string &path) {
+  CheckpointReader reader(path);
+  Scene scene;
+  scene.n = static_cast<int>(reader.header.n);
+  scene.m = static_cast<int>(reader.header.m);
+  auto cells = reader.section(CheckpointSection::Field, static_cast<size_t>(scene.n) * scene.m);
+  for (int x = 0; x < scene.n; x++) {
+    scene.field.emplace_back(cells.substr(static_cast<size_t>(x) * scene.m, scene.m));
+  }
+  return scene;
+}
+
+#endif // CHECKPOINT_HPP
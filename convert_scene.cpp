@@ -0,0 +1,45 @@
+#include <iostream>
+#include <string>
+#include "scene.hpp"
+
+// Converts a scene between the text and binary formats of scene.hpp, validating it on the way
+static void print_convert_usage(const char *program) {
+  std::cerr << "Usage: " << program << " <input> <output> [--format=binary|text]\n"
+      << "  the input format is detected, the output is binary unless --format=text\n";
+}
+
+int main(int argc, char **argv) {
+  std::string input, output;
+  bool text = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--format=text" || arg == "--format=binary") {
+      text = arg == "--format=text";
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "Unknown argument " << arg << "\n";
+      print_convert_usage(argv[0]);
+      return 1;
+    } else if (input.empty()) {
+      input = arg;
+    } else {
+      output = arg;
+    }
+  }
+  if (output.empty()) {
+    print_convert_usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    Scene scene = load_scene(input);
+    if (text) {
+      save_text_scene(output, scene);
+    } else {
+      save_binary_scene(output, scene);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
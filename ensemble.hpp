@@ -0,0 +1,233 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "options.hpp"
+#include "phase_stats.hpp"
+#include "scene.hpp"
+#include "simulator.hpp"
+
+// Many independent runs in one process. A manifest holds one job per line as whitespace
+// separated key=value pairs, '#' starts a comment:
+//   scene=path      scene file, --input by default
+//   seed=number     seed of the random generator, --seed by default
+//   rng=name        random number policy, --rng by default
+//   ticks=count     tick budget, --ticks by default
+//   g=value         gravity instead of the scene's
+//   rho=c:value     density of cell character c instead of the scene's, c may be "space";
+//                   repeatable
+//   damping=c:value damping factor of cell character c instead of the scene's, likewise
+//   stats=path      per-phase stats of the job, see phase_stats.hpp
+// Jobs run one per thread of --threads, each thread taking the next unstarted job when it
+// finishes one.
+// Every scene file is loaded once and its topology is shared by all jobs that use it. The
+// results are one CSV row per job, in manifest order:
+//   job,scene,seed,g,ticks,stop,seconds,last_delta_p
+// --steady-ticks, --steady-delta-p and --max-wall-time apply to every job on its own.
+
+struct EnsembleJob {
+  // line of the manifest, for messages
+  size_t line = 0;
+  std::string scene;
+  uint64_t seed = 0;
+  std::string rng;
+  size_t ticks = 0;
+  std::optional<double> g;
+  std::vector<std::pair<unsigned char, double> > rho;
+  std::vector<std::pair<unsigned char, double> > damping;
+  std::string stats;
+};
+
+struct EnsembleResult {
+  size_t ticks = 0;
+  const char *stop = "";
+  double seconds = 0;
+  double g = 0;
+  std::string last_delta_p;
+  // what went wrong, empty when the job ran
+  std::string error;
+};
+
+inline std::vector<EnsembleJob> parse_manifest(const std::string &path, const Options &defaults) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  std::vector<EnsembleJob> jobs;
+  std::string line;
+  for (size_t number = 1; std::getline(in, line); number++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::string word;
+    EnsembleJob job{number, defaults.input, defaults.seed, defaults.rng, defaults.ticks, {}, {}, {}, {}};
+    bool empty = true;
+    auto fail = [&](const std::string &what) {
+      throw std::runtime_error(path + ":" + std::to_string(number) + ": " + what);
+    };
+    try {
+      while (words >> word) {
+        empty = false;
+        size_t eq_pos = word.find('=');
+        if (eq_pos == std::string::npos) {
+          fail("expected key=value, found " + word);
+        }
+        std::string key = word.substr(0, eq_pos), value = word.substr(eq_pos + 1);
+        if (key == "scene") {
+          job.scene = value;
+        } else if (key == "seed") {
+          job.seed = std::stoull(value);
+        } else if (key == "rng") {
+          make_rng(value, 0);
+          job.rng = value;
+        } else if (key == "ticks") {
+          job.ticks = std::stoull(value);
+        } else if (key == "g") {
+          job.g = std::stod(value);
+        } else if (key == "rho" || key == "damping") {
+          size_t colon = value.rfind(':');
+          std::string cell = value.substr(0, colon);
+          if (colon == std::string::npos || (cell.size() != 1 && cell != "space")) {
+            fail(key + " expects c:value");
+          }
+          (key == "rho" ? job.rho : job.damping).emplace_back(
+            cell == "space" ? ' ' : static_cast<unsigned char>(cell[0]), std::stod(value.substr(colon + 1)));
+        } else if (key == "stats") {
+          job.stats = value;
+        } else {
+          fail("unknown key " + key);
+        }
+      }
+    } catch (const std::logic_error &) {
+      fail("bad value in " + word);
+    }
+    if (!empty) {
+      jobs.push_back(std::move(job));
+    }
+  }
+  return jobs;
+}
+
+// Runs every job of options.ensemble with Sim and writes the results to options.ensemble_results
+// (stdout when empty)
+template<typename Sim>
+void run_ensemble(const Options &options) {
+  using TopologyType = typename Sim::TopologyType;
+  struct SharedScene {
+    Scene scene;
+    std::shared_ptr<const TopologyType> topology;
+  };
+
+  std::vector<EnsembleJob> jobs = parse_manifest(options.ensemble, options);
+  std::map<std::string, SharedScene> scenes;
+  for (const auto &job : jobs) {
+    if (!scenes.contains(job.scene)) {
+      Scene scene = load_scene(job.scene);
+      auto topology = std::make_shared<const TopologyType>(scene.field, scene.n, scene.m);
+      scenes.emplace(job.scene, SharedScene{std::move(scene), std::move(topology)});
+    }
+  }
+
+  std::vector<EnsembleResult> results(jobs.size());
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      const EnsembleJob &job = jobs[i];
+      EnsembleResult &result = results[i];
+      try {
+        const SharedScene &shared = scenes.at(job.scene);
+        auto simulator = std::make_unique<Sim>(shared.scene, shared.topology);
+        std::array<double, 256> rho = shared.scene.rho;
+        std::array<double, 256> damping = shared.scene.damping;
+        for (auto [cell, density] : job.rho) {
+          rho[cell] = density;
+        }
+        for (auto [cell, factor] : job.damping) {
+          damping[cell] = factor;
+        }
+        result.g = job.g.value_or(shared.scene.g);
+        simulator->set_constants(result.g, rho, damping);
+        simulator->set_rng(make_rng(job.rng, job.seed));
+        simulator->set_steady_state(options.steady_ticks, options.steady_delta_p);
+        std::unique_ptr<PhaseStats> stats;
+        if (!job.stats.empty()) {
+          stats = std::make_unique<PhaseStats>(job.stats, options.stats_every, options.perf_counters);
+          simulator->set_phase_stats(stats.get());
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (options.max_wall_time > 0) {
+          simulator->set_deadline(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                    std::chrono::duration<double>(options.max_wall_time)));
+        }
+        simulator->execute(job.ticks);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.ticks = simulator->ticks_done();
+        switch (simulator->stop_reason()) {
+          case StopReason::Steady:
+            result.stop = "steady";
+            break;
+          case StopReason::WallTime:
+            result.stop = "wall-time";
+            break;
+          case StopReason::None:
+            result.stop = "ticks";
+            break;
+        }
+        std::ostringstream delta_p;
+        delta_p << simulator->last_delta_p();
+        result.last_delta_p = delta_p.str();
+      } catch (const std::exception &e) {
+        result.error = e.what();
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(options.threads, jobs.size()); i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  std::ofstream file;
+  if (!options.ensemble_results.empty()) {
+    file.open(options.ensemble_results);
+    if (!file.is_open()) {
+      throw std::runtime_error("Failed to open " + options.ensemble_results);
+    }
+  }
+  std::ostream &out = options.ensemble_results.empty() ? std::cout : file;
+  out << "job,scene,seed,g,ticks,stop,seconds,last_delta_p\n";
+  size_t failed = 0;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const auto &result = results[i];
+    if (!result.error.empty()) {
+      std::cerr << options.ensemble << ":" << jobs[i].line << ": " << result.error << "\n";
+      failed++;
+      continue;
+    }
+    out << i << "," << jobs[i].scene << "," << jobs[i].seed << "," << result.g << "," << result.ticks << ","
+        << result.stop << "," << result.seconds << "," << result.last_delta_p << "\n";
+  }
+  if (failed != 0) {
+    throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(jobs.size()) + " jobs failed");
+  }
+}
+
+#endif // ENSEMBLE_HPP
@@ -5,10 +5,42 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "grid.hpp"
 
 constexpr std::array<std::pair<int, int>, 4> deltas{{{-1, 0}, {1, 0}, {0, -1}, {0, 1}}};
 
+// Indices into deltas
+enum Direction : size_t { Up = 0, Down = 1, Left = 2, Right = 3 };
+
+// opposite[i] is the index of (-dx, -dy) for deltas[i] = (dx, dy)
+constexpr std::array<size_t, deltas.size()> opposite{Down, Up, Right, Left};
+
+constexpr size_t direction_index(int dx, int dy) {
+  size_t i = std::ranges::find(deltas, std::pair(dx, dy)) - deltas.begin();
+  assert(i < deltas.size());
+  return i;
+}
+
+static_assert([] {
+  for (size_t i = 0; i < deltas.size(); i++) {
+    if (direction_index(-deltas[i].first, -deltas[i].second) != opposite[i]) {
+      return false;
+    }
+  }
+  return true;
+}());
+
 
 
 using FieldStorageType = std::vector<std::string>;
@@ -40,14 +72,38 @@ struct Fixed {
       >
     > >;
 
-  constexpr explicit Fixed(std::mt19937 &rnd) : v(rnd() & ((1 << Q) - 1)) {
+  // Integer the products and quotients of raw values are computed in, so v * other.v and
+  // v << Q cannot overflow before the result is scaled back
+  __extension__ using WideType = std::conditional_t<(sizeof(StorageType) <= 4), int64_t, __int128>;
+
+  // 2^Q as a double, exact for every Q < 64
+  static constexpr double scale = [] {
+    double one = 1;
+    for (int i = 0; i < Q; i++) {
+      one *= 2;
+    }
+    return one;
+  }();
+
+  template<std::uniform_random_bit_generator Generator>
+  constexpr explicit Fixed(Generator &rnd) : v(rnd() & ((1 << Q) - 1)) {
   }
 
   explicit constexpr Fixed(int v) : v(static_cast<StorageType>(v) << Q) {
   }
-  explicit constexpr Fixed(float f) : v(static_cast<StorageType>(std::round(f * (1 << Q)))) {
+  explicit constexpr Fixed(float f) : Fixed(static_cast<double>(f)) {
   }
-  explicit constexpr Fixed(double f) : v(static_cast<StorageType>(std::round(f * (1 << Q)))) {
+  // Rounds to the nearest raw value, halfway cases away from zero
+  explicit constexpr Fixed(double f) : v(static_cast<StorageType>(round(f * scale))) {
+  }
+  // From another Fixed: widening Q is exact, narrowing it rounds towards -inf like the shift
+  // of operator*; integer bits that do not fit wrap around
+  template<int P2, int Q2, bool fast2>
+  explicit constexpr Fixed(Fixed<P2, Q2, fast2> other) : v(0) {
+    using Wide = std::conditional_t<(sizeof(WideType) > sizeof(typename Fixed<P2, Q2, fast2>::WideType)), WideType,
+                                    typename Fixed<P2, Q2, fast2>::WideType>;
+    Wide raw = other.v;
+    v = static_cast<StorageType>(Q >= Q2 ? raw << (Q - Q2) : raw >> (Q2 - Q));
   }
   constexpr Fixed() : v(0) {
   }
@@ -59,11 +115,20 @@ struct Fixed {
   }
 
   constexpr double to_double() const {
-    return static_cast<double>(v) / (1 << Q);
+    return static_cast<double>(v) / scale;
   }
 
+  // Rounded once from the exact double, not from a float of v
   constexpr float to_float() const {
-    return static_cast<float>(v) / (1 << Q);
+    return static_cast<float>(to_double());
+  }
+
+  explicit constexpr operator double() const {
+    return to_double();
+  }
+
+  explicit constexpr operator float() const {
+    return to_float();
   }
 
   auto operator<=>(const Fixed &) const = default;
@@ -78,11 +143,11 @@ struct Fixed {
   }
 
   constexpr Fixed operator*(const Fixed &other) const {
-    return Fixed::from_raw((v * other.v) >> Q);
+    return Fixed::from_raw(static_cast<StorageType>((WideType(v) * other.v) >> Q));
   }
 
   constexpr Fixed operator/(const Fixed &other) const {
-    return Fixed::from_raw((v << Q) / other.v);
+    return Fixed::from_raw(static_cast<StorageType>((WideType(v) << Q) / other.v));
   }
 
   Fixed &operator=(const int &&num) {
@@ -124,7 +189,7 @@ struct Fixed {
   }
 
   friend std::ostream &operator<<(std::ostream &out, const Fixed &x) {
-    return out << x.v / (double) (1 << Q);
+    return out << x.to_double();
   }
 
   StorageType inf() {
@@ -136,29 +201,90 @@ struct Fixed {
   }
 
   StorageType v;
+
+  private:
+    // std::round is not constexpr before C++23
+    static constexpr double round(double x) {
+      if (!std::is_constant_evaluated()) {
+        return std::round(x);
+      }
+      double whole = static_cast<double>(static_cast<WideType>(x));
+      if (x - whole >= 0.5) {
+        return whole + 1;
+      }
+      if (whole - x >= 0.5) {
+        return whole - 1;
+      }
+      return whole;
+    }
+};
+
+static_assert(Fixed<32, 16>(0.8).v == 52429 && Fixed<32, 16>(-0.8).v == -52429);
+static_assert(Fixed<16, 8, true>(Fixed<32, 16>(-1.5)).v == -384 && Fixed<32, 16>(Fixed<16, 8>(1.5)).v == 98304);
+static_assert(double(Fixed<32, 16>(3) * Fixed<32, 16>(2)) == 6 && double(Fixed<32, 16>(3) / Fixed<32, 16>(2)) == 1.5);
+
+// Spelling of a type as it appears in TYPES and on the command line
+template<typename Type>
+struct TypeName;
+
+template<>
+struct TypeName<float> {
+  static std::string get() { return "FLOAT"; }
+};
+
+template<>
+struct TypeName<double> {
+  static std::string get() { return "DOUBLE"; }
 };
 
-template<typename FixedType>
+template<int P, int Q>
+struct TypeName<Fixed<P, Q, false> > {
+  static std::string get() { return "FIXED(" + std::to_string(P) + "," + std::to_string(Q) + ")"; }
+};
+
+template<int P, int Q>
+struct TypeName<Fixed<P, Q, true> > {
+  static std::string get() { return "FAST_FIXED(" + std::to_string(P) + "," + std::to_string(Q) + ")"; }
+};
+
+template<typename FixedType, size_t N = 0, size_t M = 0, GridLayout Layout = default_grid_layout>
 struct VectorField {
   using Fixed = FixedType;
 
-  std::vector<std::vector<
-    std::array<Fixed, deltas.size()>
-  > > v;
+  VelocityStorage<Fixed, N, M, Layout> v;
+
+  VectorField(int n, int m) : v(n, m) {
+  }
+
+  Fixed &get(int x, int y, size_t dir) {
+    return v.at(x, y, dir);
+  }
+
+  const Fixed &get(int x, int y, size_t dir) const {
+    return v.at(x, y, dir);
+  }
+
+  template<size_t Dir>
+  Fixed &get(int x, int y) {
+    static_assert(Dir < deltas.size());
+    return v.at(x, y, Dir);
+  }
+
+  Fixed &add(int x, int y, size_t dir, Fixed dv) {
+    return get(x, y, dir) += dv;
+  }
 
-  VectorField() = default;
-  VectorField(int n, int m) {
-    v.resize(n, std::vector<std::array<Fixed, deltas.size()> >(m));
+  // (dx, dy) forms look the direction up in deltas, hot loops use the index forms above
+  Fixed &get(int x, int y, int dx, int dy) {
+    return get(x, y, direction_index(dx, dy));
   }
 
   Fixed &add(int x, int y, int dx, int dy, Fixed dv) {
     return get(x, y, dx, dy) += dv;
   }
 
-  Fixed &get(int x, int y, int dx, int dy) {
-    size_t i = std::ranges::find(deltas, std::pair(dx, dy)) - deltas.begin();
-    assert(i < deltas.size());
-    return v[x][y][i];
+  void clear() {
+    v.fill(Fixed{});
   }
 };
 
@@ -1,8 +1,15 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include "state_hash.hpp"
 
 using namespace std;
 
@@ -310,7 +317,32 @@ bool propagate_move(int x, int y, bool is_first) {
 
 int dirs[N][M]{};
 
-int main() {
+int main(int argc, char **argv) {
+  // --ticks=count runs that many ticks instead of T, --trace, --dump-state and --dump-tick
+  // write the state hashes of state_hash.hpp like the templated engine does
+  size_t ticks = T;
+  string trace_path, dump_path;
+  size_t dump_tick = 0;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.rfind("--ticks=", 0) == 0) {
+      ticks = stoull(arg.substr(8));
+    } else if (arg.rfind("--trace=", 0) == 0) {
+      trace_path = arg.substr(8);
+    } else if (arg.rfind("--dump-state=", 0) == 0) {
+      dump_path = arg.substr(13);
+    } else if (arg.rfind("--dump-tick=", 0) == 0) {
+      dump_tick = stoull(arg.substr(12));
+    }
+  }
+  unique_ptr<StateTrace> trace;
+  if (!trace_path.empty()) {
+    trace = make_unique<StateTrace>(trace_path, dump_path, dump_tick);
+  }
+  auto cell = [](size_t x, size_t y) { return field[x][y]; };
+  auto pressure = [](size_t x, size_t y) { return p[x][y].v; };
+  auto speed = [](size_t x, size_t y, size_t i) { return velocity.v[x][y][i].v; };
+
   rho[' '] = 0.01;
   rho['.'] = 10000;
 
@@ -326,7 +358,7 @@ int main() {
     }
   }
 
-  for (size_t i = 0; i < T; ++i) {
+  for (size_t i = 0; i < ticks; ++i) {
     Fixed total_delta_p = 0;
     // Apply external forces
     for (size_t x = 0; x < N; ++x) {
@@ -429,5 +461,14 @@ int main() {
         cout << field[x] << "\n";
       }
     }
+
+    if (trace) {
+      ostringstream rng_state;
+      rng_state << rnd;
+      trace->record(i, hash_state(N, M, cell, pressure, speed, rng_state.str()));
+      if (trace->wants_dump(i)) {
+        write_state_dump(trace->dump_file(), i + 1, N, M, cell, pressure, speed);
+      }
+    }
   }
 }
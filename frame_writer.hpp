@@ -0,0 +1,245 @@
+#ifndef FRAME_WRITER_HPP
+#define FRAME_WRITER_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Rectangle of the field that is written out, rows [x0, x1) and columns [y0, y1).
+// Empty (the default) means the whole field.
+struct FrameRegion {
+  size_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+  bool empty() const { return x1 == 0 && y1 == 0; }
+};
+
+struct FrameOptions {
+  bool enabled = true;
+  // only ticks divisible by every are written, with any movement since the last frame
+  size_t every = 1;
+  // wall-clock frame rate cap, 0 for none
+  double max_fps = 0;
+  FrameRegion region;
+  // stdout when empty
+  std::string path;
+  // replace the oldest queued frame instead of waiting when the writer falls behind
+  bool drop = false;
+};
+
+// Writes "Tick i:" frames on a background thread. The simulation copies the field into one
+// of three buffers and hands it over, so it only waits when two frames are already queued
+// (never, with drop set). The writer batches frames into large write() calls and flushes
+// whenever it runs out of queued frames.
+class FrameWriter {
+  public:
+    FrameWriter(const FrameOptions &options, size_t n, size_t m) : options(options) {
+      region = options.region.empty() ? FrameRegion{0, 0, n, m} : options.region;
+      region.x1 = std::min(region.x1, n);
+      region.y1 = std::min(region.y1, m);
+      if (region.x0 >= region.x1 || region.y0 >= region.y1) {
+        throw std::runtime_error("Frame region is outside of the field");
+      }
+      if (!options.enabled) {
+        return;
+      }
+
+      fd = options.path.empty() ? STDOUT_FILENO : ::open(options.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        throw std::runtime_error("Failed to open " + options.path);
+      }
+      io_buffer.reserve(1 << 22);
+
+      size_t width = region.y1 - region.y0;
+      for (auto &frame : frames) {
+        frame.cells.resize((region.x1 - region.x0) * (width + 1));
+      }
+      for (size_t i = 0; i < frames.size(); i++) {
+        free_frames.push(i);
+      }
+      thread = std::thread([this] { write_loop(); });
+    }
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    ~FrameWriter() {
+      if (thread.joinable()) {
+        {
+          std::lock_guard lock(mutex);
+          stopping = true;
+        }
+        ready_cv.notify_one();
+        thread.join();
+      }
+      if (fd > STDOUT_FILENO) {
+        ::close(fd);
+      }
+    }
+
+    // Called by the simulation after every tick, `field` rows must be indexable as field[x][y]
+    template<typename Field>
+    void on_tick(size_t tick, bool moved, const Field &field) {
+      dirty |= moved;
+      if (!options.enabled || !dirty || tick % options.every != 0) {
+        return;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (options.max_fps > 0 && now - last_frame < std::chrono::duration<double>(1 / options.max_fps)) {
+        return;
+      }
+      last_frame = now;
+      dirty = false;
+
+      size_t index = acquire();
+      Frame &frame = frames[index];
+      frame.tick = tick;
+      size_t width = region.y1 - region.y0;
+      char *dst = frame.cells.data();
+      for (size_t x = region.x0; x < region.x1; ++x) {
+        std::memcpy(dst, &field[x][region.y0], width);
+        dst[width] = '\n';
+        dst += width + 1;
+      }
+      publish(index);
+    }
+
+    size_t dropped_frames() const {
+      return dropped;
+    }
+
+  private:
+    struct Frame {
+      size_t tick = 0;
+      // rows of the region, each followed by '\n'
+      std::vector<char> cells;
+    };
+
+    // FIFO of frame indices, fixed capacity so handing frames over never allocates
+    struct FrameQueue {
+      std::array<size_t, 3> slots{};
+      size_t head = 0, count = 0;
+
+      bool empty() const { return count == 0; }
+      size_t front() const { return slots[head]; }
+
+      void push(size_t index) {
+        slots[(head + count++) % slots.size()] = index;
+      }
+
+      size_t pop() {
+        size_t index = slots[head];
+        head = (head + 1) % slots.size();
+        count--;
+        return index;
+      }
+    };
+
+    size_t acquire() {
+      std::unique_lock lock(mutex);
+      if (free_frames.empty() && options.drop) {
+        dropped++;
+        return ready_frames.pop();
+      }
+      free_cv.wait(lock, [this] { return !free_frames.empty(); });
+      return free_frames.pop();
+    }
+
+    void publish(size_t index) {
+      {
+        std::lock_guard lock(mutex);
+        ready_frames.push(index);
+      }
+      ready_cv.notify_one();
+    }
+
+    void write_loop() {
+      while (true) {
+        size_t index;
+        {
+          std::unique_lock lock(mutex);
+          if (ready_frames.empty()) {
+            lock.unlock();
+            flush();
+            lock.lock();
+          }
+          ready_cv.wait(lock, [this] { return stopping || !ready_frames.empty(); });
+          if (ready_frames.empty()) {
+            lock.unlock();
+            flush();
+            return;
+          }
+          index = ready_frames.pop();
+        }
+        const Frame &frame = frames[index];
+        char header[32];
+        int length = std::snprintf(header, sizeof header, "Tick %zu:\n", frame.tick);
+        append(header, length);
+        append(frame.cells.data(), frame.cells.size());
+        {
+          std::lock_guard lock(mutex);
+          free_frames.push(index);
+        }
+        free_cv.notify_one();
+      }
+    }
+
+    void append(const char *data, size_t size) {
+      if (io_buffer.size() + size > io_buffer.capacity()) {
+        flush();
+      }
+      if (size > io_buffer.capacity()) {
+        write_all(data, size);
+        return;
+      }
+      io_buffer.insert(io_buffer.end(), data, data + size);
+    }
+
+    void flush() {
+      write_all(io_buffer.data(), io_buffer.size());
+      io_buffer.clear();
+    }
+
+    void write_all(const char *data, size_t size) {
+      while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          // nowhere left to report to, stop producing output
+          return;
+        }
+        data += written;
+        size -= written;
+      }
+    }
+
+    FrameOptions options;
+    FrameRegion region;
+    int fd = -1;
+    std::vector<char> io_buffer;
+
+    bool dirty = false;
+    std::chrono::steady_clock::time_point last_frame{};
+
+    std::array<Frame, 3> frames;
+    std::mutex mutex;
+    std::condition_variable ready_cv, free_cv;
+    FrameQueue free_frames, ready_frames;
+    bool stopping = false;
+    size_t dropped = 0;
+    std::thread thread;
+};
+
+#endif // FRAME_WRITER_HPP
@@ -0,0 +1,111 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+// Lazy sequence produced by a coroutine that co_yields Type values, the subset of C++23
+// std::generator that range-for needs. The coroutine runs only while the caller advances the
+// iterator, a yielded value lives until the next advance.
+template<typename Type>
+class Generator {
+  public:
+    struct promise_type {
+      const Type *value = nullptr;
+      std::exception_ptr error;
+
+      Generator get_return_object() {
+        return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+
+      std::suspend_always yield_value(const Type &yielded) noexcept {
+        value = std::addressof(yielded);
+        return {};
+      }
+
+      void return_void() noexcept {
+      }
+
+      void unhandled_exception() {
+        error = std::current_exception();
+      }
+    };
+
+    class iterator {
+      public:
+        using value_type = Type;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(std::coroutine_handle<promise_type> handle) : handle(handle) {
+        }
+
+        const Type &operator*() const {
+          return *handle.promise().value;
+        }
+
+        const Type *operator->() const {
+          return handle.promise().value;
+        }
+
+        iterator &operator++() {
+          resume(handle);
+          return *this;
+        }
+
+        void operator++(int) {
+          ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const {
+          return !handle || handle.done();
+        }
+
+      private:
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    explicit Generator(std::coroutine_handle<promise_type> handle) : handle(handle) {
+    }
+
+    Generator(Generator &&other) noexcept : handle(std::exchange(other.handle, {})) {
+    }
+
+    Generator(const Generator &) = delete;
+    Generator &operator=(const Generator &) = delete;
+
+    ~Generator() {
+      if (handle) {
+        handle.destroy();
+      }
+    }
+
+    iterator begin() {
+      resume(handle);
+      return iterator(handle);
+    }
+
+    std::default_sentinel_t end() const {
+      return {};
+    }
+
+  private:
+    // Runs the coroutine to its next co_yield or its end, rethrowing what escaped it
+    static void resume(std::coroutine_handle<promise_type> handle) {
+      handle.resume();
+      if (handle.promise().error) {
+        std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+      }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif // GENERATOR_HPP
@@ -0,0 +1,219 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+constexpr size_t cache_line_size = 64;
+
+enum class VelocityLayout {
+  // array of 4 directions per cell
+  AoS,
+  // one grid per direction
+  SoA,
+};
+
+// Memory layout shared by all per-cell layers of a Simulator
+struct GridLayout {
+  // round each row up to a whole number of cache lines
+  bool padded = false;
+  VelocityLayout velocity = VelocityLayout::AoS;
+};
+
+#ifndef FLUID_GRID_PADDED
+#define FLUID_GRID_PADDED false
+#endif
+
+#ifndef FLUID_VELOCITY_LAYOUT
+#define FLUID_VELOCITY_LAYOUT AoS
+#endif
+
+constexpr GridLayout default_grid_layout{FLUID_GRID_PADDED, VelocityLayout::FLUID_VELOCITY_LAYOUT};
+
+// Distance in elements between the starts of consecutive rows
+template<typename Type>
+constexpr size_t grid_stride(size_t m, bool padded) {
+  if (!padded || sizeof(Type) > cache_line_size || cache_line_size % sizeof(Type) != 0) {
+    return m;
+  }
+  constexpr size_t per_line = cache_line_size / sizeof(Type);
+  return (m + per_line - 1) / per_line * per_line;
+}
+
+template<typename Type, size_t N, size_t M, bool Padded>
+struct GridStorage {
+  static constexpr size_t stride = grid_stride<Type>(M, Padded);
+
+  using Cells = std::array<Type, N * stride>;
+
+  // Heap allocated so big static grids stay off the stack and swap in O(1)
+  GridStorage(size_t, size_t) : cells(new(std::align_val_t(cache_line_size)) Cells{}) {
+  }
+
+  GridStorage(const GridStorage &other) : GridStorage(N, M) {
+    *this = other;
+  }
+
+  GridStorage &operator=(const GridStorage &other) {
+    *cells = *other.cells;
+    return *this;
+  }
+
+  GridStorage(GridStorage &&) = default;
+  GridStorage &operator=(GridStorage &&) = default;
+
+  Type *data() { return cells->data(); }
+  const Type *data() const { return cells->data(); }
+
+  struct AlignedDelete {
+    void operator()(Cells *ptr) const {
+      ptr->~Cells();
+      ::operator delete(ptr, std::align_val_t(cache_line_size));
+    }
+  };
+
+  std::unique_ptr<Cells, AlignedDelete> cells;
+};
+
+template<typename Type, bool Padded>
+struct GridStorage<Type, 0, 0, Padded> {
+  // cells are released without running destructors
+  static_assert(std::is_trivially_destructible_v<Type>);
+
+  size_t stride;
+
+  GridStorage(size_t n, size_t m) : stride(grid_stride<Type>(m, Padded)), size(n * stride) {
+    if (size != 0) {
+      cells.reset(new(std::align_val_t(cache_line_size)) Type[size]());
+    }
+  }
+
+  GridStorage(const GridStorage &other) : GridStorage(0, 0) {
+    *this = other;
+  }
+
+  GridStorage &operator=(const GridStorage &other) {
+    if (this != &other) {
+      if (size != other.size) {
+        cells.reset(other.size ? new(std::align_val_t(cache_line_size)) Type[other.size] : nullptr);
+        size = other.size;
+      }
+      stride = other.stride;
+      std::copy_n(other.data(), size, data());
+    }
+    return *this;
+  }
+
+  GridStorage(GridStorage &&) = default;
+  GridStorage &operator=(GridStorage &&) = default;
+
+  Type *data() { return cells.get(); }
+  const Type *data() const { return cells.get(); }
+
+  struct AlignedDelete {
+    void operator()(Type *ptr) const {
+      ::operator delete[](ptr, std::align_val_t(cache_line_size));
+    }
+  };
+
+  size_t size;
+  std::unique_ptr<Type[], AlignedDelete> cells;
+};
+
+// Row-major n x m layer in a single cache-line aligned block, allocated once at construction.
+// With compile-time N and M the block is a std::array and the bounds and stride are constants.
+template<typename Type, size_t N = 0, size_t M = 0, bool Padded = false>
+class Grid {
+  public:
+    Grid(size_t n, size_t m) : n(n), m(m), storage(n, m) {
+    }
+
+    Type *operator[](size_t x) { return storage.data() + x * stride(); }
+    const Type *operator[](size_t x) const { return storage.data() + x * stride(); }
+
+    Type &operator()(size_t x, size_t y) { return (*this)[x][y]; }
+    const Type &operator()(size_t x, size_t y) const { return (*this)[x][y]; }
+
+    size_t rows() const { return N ? N : n; }
+    size_t cols() const { return M ? M : m; }
+    size_t stride() const { return storage.stride; }
+
+    // Whole allocation including row padding, rows() * stride() elements
+    Type *data() { return storage.data(); }
+    const Type *data() const { return storage.data(); }
+
+    void fill(const Type &value) {
+      std::fill_n(data(), rows() * stride(), value);
+    }
+
+    // Exchanges the blocks without copying cells
+    friend void swap(Grid &a, Grid &b) noexcept {
+      std::swap(a.n, b.n);
+      std::swap(a.m, b.m);
+      std::swap(a.storage, b.storage);
+    }
+
+  private:
+    size_t n, m;
+    GridStorage<Type, N, M, Padded> storage;
+};
+
+template<typename Type, size_t N, size_t M, GridLayout Layout, VelocityLayout = Layout.velocity>
+class VelocityStorage;
+
+template<typename Type, size_t N, size_t M, GridLayout Layout>
+class VelocityStorage<Type, N, M, Layout, VelocityLayout::AoS> {
+  public:
+    using Cell = std::array<Type, 4>;
+
+    VelocityStorage(size_t n, size_t m) : cells(n, m) {
+    }
+
+    Type &at(size_t x, size_t y, size_t i) { return cells[x][y][i]; }
+    const Type &at(size_t x, size_t y, size_t i) const { return cells[x][y][i]; }
+
+    void swap_cell(size_t x, size_t y, Cell &other) {
+      std::swap(cells[x][y], other);
+    }
+
+    void fill(const Type &value) {
+      cells.fill({value, value, value, value});
+    }
+
+  private:
+    Grid<Cell, N, M, Layout.padded> cells;
+};
+
+template<typename Type, size_t N, size_t M, GridLayout Layout>
+class VelocityStorage<Type, N, M, Layout, VelocityLayout::SoA> {
+  public:
+    using Cell = std::array<Type, 4>;
+
+    VelocityStorage(size_t n, size_t m) : planes{{{n, m}, {n, m}, {n, m}, {n, m}}} {
+    }
+
+    Type &at(size_t x, size_t y, size_t i) { return planes[i][x][y]; }
+    const Type &at(size_t x, size_t y, size_t i) const { return planes[i][x][y]; }
+
+    void swap_cell(size_t x, size_t y, Cell &other) {
+      for (size_t i = 0; i < planes.size(); i++) {
+        std::swap(planes[i][x][y], other[i]);
+      }
+    }
+
+    void fill(const Type &value) {
+      for (auto &plane : planes) {
+        plane.fill(value);
+      }
+    }
+
+  private:
+    std::array<Grid<Type, N, M, Layout.padded>, 4> planes;
+};
+
+#endif // GRID_HPP
@@ -1,94 +1,126 @@
-#include <fstream>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <string>
+#include "checkpoint.hpp"
+#include "ensemble.hpp"
+#include "frame_writer.hpp"
+#include "move_log.hpp"
+#include "options.hpp"
+#include "phase_stats.hpp"
+#include "registry.hpp"
+#include "scene.hpp"
+#include "simd.hpp"
 #include "simulator.hpp"
+#include "thread_pool.hpp"
 
-#define FLOAT            float
-#define DOUBLE           double
-#define FAST_FIXED(N, K) types::FastFixed<N, K>
-#define FIXED(N, K)      types::Fixed<N, K>
-
-#ifndef TYPES
-#define TYPES
+#ifndef SIZES
+#define SIZES
 #endif
 
-// using triple = std::tuple<std::string, std::string, std::string>;
-// std::unordered_map<triple, std::function<void()> > registry;
-
-constexpr size_t P = 32, Q = 16;
-
-template<typename FixedCls>
-void load_constants(int &n, int &m, int &k, FixedCls rho[256], FixedCls &g, FieldStorageType &field) {
-  double g_float;
-
-  std::ifstream input_file("input.txt");
-
-  if (!input_file.is_open()) {
-    std::cerr << "Failed to open input file" << std::endl;
-    exit(1);
-  }
-  input_file >> n >> m >> g_float >> k;
-  g = FixedCls(g_float);
-  input_file.ignore(std::numeric_limits<size_t>::max(), '\n');
-  input_file.get();
-
-  field.resize(n);
-
-  for (int i = 0; i < k; i++) {
-    char c;
-    double f;
-    input_file.get(c);
-    input_file.get();
-    input_file >> f;
-    rho[static_cast<int>(c)] = FixedCls(f);
-    input_file.ignore(std::numeric_limits<size_t>::max(), '\n');
-    input_file.get();
-  }
-
-  for (int i = 0; i < n; i++) {
-    std::string row;
-    std::getline(input_file, row, '\n');
-    field[i] = row;
+// One line on stderr telling when and why the run ended
+template<typename Sim>
+void print_stop_summary(const Sim &simulator, const Options &options, double seconds) {
+  std::cerr << "Stopped after tick " << simulator.ticks_done() << ", " << seconds << " s: ";
+  switch (simulator.stop_reason()) {
+    case StopReason::Steady:
+      std::cerr << "steady state, " << simulator.quiet_ticks() << " ticks without movement and |total_delta_p| <= "
+          << options.steady_delta_p;
+      break;
+    case StopReason::WallTime:
+      std::cerr << "wall time limit of " << options.max_wall_time << " s";
+      break;
+    case StopReason::None:
+      std::cerr << "tick limit of " << options.ticks;
+      break;
   }
+  std::cerr << " (last total_delta_p " << simulator.last_delta_p() << ")\n";
 }
 
 template<typename PType, typename VType, typename VFlowType>
-void process_type() {
-  int n, m;
-  int k;
-  PType rho[256];
-  PType g;
-  FieldStorageType field;
-
-  load_constants(n, m, k, rho, g, field);
-  Simulator<PType, VType, VFlowType> simulator(n, m, g, rho, field);
-  simulator.execute();
-}
+struct ProcessType {
+  static void run(const Options &options) {
+    if (!options.ensemble.empty()) {
+      // jobs may come from scenes of any size, so they all use the dynamic-size version
+      run_ensemble<Simulator<PType, VType, VFlowType> >(options);
+      return;
+    }
+    Scene scene = options.resume.empty() ? load_scene(options.input) : checkpoint_scene(options.resume);
+    with_static_size(scene.n, scene.m, TypeList<SIZES>(), [&]<size_t N, size_t M>() {
+      auto simulator = std::make_unique<Simulator<PType, VType, VFlowType, N, M> >(scene);
+      simulator->set_rng(make_rng(options.rng, options.seed));
+      simulator->set_parallel_move(options.parallel_move);
+      if (!options.resume.empty()) {
+        simulator->load_checkpoint(options.resume);
+      }
+      FrameWriter frames(options.frames, scene.n, scene.m);
+      std::unique_ptr<ThreadPool> pool;
+      if (options.threads > 1) {
+        pool = std::make_unique<ThreadPool>(options.threads);
+        simulator->set_thread_pool(pool.get());
+      }
+      std::unique_ptr<MoveLogWriter> move_log;
+      if (!options.move_log.empty()) {
+        move_log = std::make_unique<MoveLogWriter>(options.move_log);
+        simulator->set_move_log(move_log.get());
+      }
+      std::unique_ptr<StateTrace> trace;
+      if (!options.trace.empty()) {
+        trace = std::make_unique<StateTrace>(options.trace, options.dump_state, options.dump_tick);
+        simulator->set_state_trace(trace.get());
+      }
+      std::unique_ptr<PhaseStats> stats;
+      if (!options.stats.empty()) {
+        if (!stats_enabled) {
+          std::cerr << "Built with FLUID_STATS=0, --stats writes no rows\n";
+        }
+        stats = std::make_unique<PhaseStats>(options.stats, options.stats_every, options.perf_counters);
+        simulator->set_phase_stats(stats.get());
+      }
+      auto start = std::chrono::steady_clock::now();
+      simulator->set_steady_state(options.steady_ticks, options.steady_delta_p);
+      if (options.max_wall_time > 0) {
+        simulator->set_deadline(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(options.max_wall_time)));
+      }
+      if (options.checkpoint.empty()) {
+        simulator->execute(options.ticks, &frames);
+      }
+      while (!options.checkpoint.empty() && simulator->ticks_done() < options.ticks &&
+             simulator->stop_reason() == StopReason::None) {
+        size_t every = options.checkpoint_every;
+        simulator->execute(std::min(options.ticks, (simulator->ticks_done() / every + 1) * every), &frames);
+        std::string path = options.checkpoint;
+        if (options.checkpoint_keep) {
+          path += "." + std::to_string(simulator->ticks_done());
+        }
+        simulator->save_checkpoint(path);
+      }
+      print_stop_summary(*simulator, options,
+                         std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    });
+  }
+};
 
 int main(int argc, char **argv) {
-  std::unordered_map<std::string, std::string> arg_map;
-  if (argc < 5) {
-    std::cerr << "Usage: " << argv[0] << " --p-type=... --v-type=... --v-flow-type=...\n";
+  Options options;
+  if (argc < 4 || !parse_options(argc, argv, options)) {
+    print_usage(argv[0]);
     return 1;
   }
-  for (int i = 1; i < argc; i++) {
-    std::string arg_str = argv[i];
-    size_t eq_pos = arg_str.find('=');
-    std::string key = arg_str.substr(0, eq_pos);
-    std::string value = arg_str.substr(eq_pos + 1);
-    arg_map[key] = value;
+  if (!options.simd) {
+    simd_level = SimdLevel::Scalar;
   }
 
-  std::string p_type, v_type, vf_type;
-
-  if (arg_map.find("--p-type") == arg_map.end() || arg_map.find("--v-type") == arg_map.end() || arg_map.
-    find("--v-flow-type") == arg_map.end()) {
-    std::cerr << "Missing required argument\n";
+  auto registry = make_registry<ProcessType>(TypeList<TYPES>());
+  try {
+    if (!dispatch(registry, options)) {
+      return 1;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
     return 1;
   }
-  // p_type = arg_map["--p-type"];
-  // v_type = arg_map["--v-type"];
-  // vf_type = arg_map["--v-flow-type"];
-
-  process_type<Fixed<P, Q, true>, Fixed<P, Q, true>, Fixed<P, Q, true> >();
   return 0;
 }
@@ -0,0 +1,60 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory map of a whole file
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+      }
+      struct stat st{};
+      if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat " + path);
+      }
+      length = static_cast<size_t>(st.st_size);
+      if (length != 0) {
+        void *ptr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+          ::close(fd);
+          throw std::runtime_error("Failed to map " + path);
+        }
+        bytes = static_cast<const char *>(ptr);
+        ::madvise(ptr, length, MADV_SEQUENTIAL);
+      }
+      ::close(fd);
+    }
+
+    MappedFile(MappedFile &&other) noexcept
+      : bytes(std::exchange(other.bytes, nullptr)), length(std::exchange(other.length, 0)) {
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+      if (bytes != nullptr) {
+        ::munmap(const_cast<char *>(bytes), length);
+      }
+    }
+
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+};
+
+#endif // MAPPED_FILE_HPP
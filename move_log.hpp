@@ -0,0 +1,224 @@
+#ifndef MOVE_LOG_HPP
+#define MOVE_LOG_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "fixed.hpp"
+#include "mapped_file.hpp"
+
+// Compact record of what propagate_move changed. Layout:
+//   header       magic "FLUIDML\0", u32 version, u32 n, u32 m, u64 first tick
+//   field        n * m chars, the field before the first logged tick
+//   tick records one per tick with movement:
+//                  varint  tick - previous record tick (previous = first tick initially)
+//                  varint  number of swaps
+//                  varint  per swap: zigzag(cell - previous cell) << 2 | direction
+// where cell = x * m + y of the first swapped cell (previous cell starts at 0 in every
+// record) and the second one is its neighbour deltas[direction]. Replaying the swaps in order
+// from the stored field reproduces every frame without redoing the physics.
+
+constexpr std::array<char, 8> move_log_magic{'F', 'L', 'U', 'I', 'D', 'M', 'L', '\0'};
+constexpr uint32_t move_log_version = 1;
+
+struct MoveLogHeader {
+  std::array<char, 8> magic = move_log_magic;
+  uint32_t version = move_log_version;
+  uint32_t n = 0;
+  uint32_t m = 0;
+  uint32_t reserved = 0;
+  uint64_t first_tick = 0;
+};
+
+inline void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class MoveLogWriter {
+  public:
+    explicit MoveLogWriter(const std::string &path) : path(path), out(std::fopen(path.c_str(), "wb")) {
+      if (out == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+      }
+      buffer.reserve(flush_size * 2);
+      swaps.reserve(1 << 12);
+    }
+
+    MoveLogWriter(const MoveLogWriter &) = delete;
+    MoveLogWriter &operator=(const MoveLogWriter &) = delete;
+
+    ~MoveLogWriter() {
+      flush();
+      std::fclose(out);
+    }
+
+    // Writes the header and the field the following records start from
+    template<typename Field>
+    void begin(size_t n, size_t m, size_t tick, const Field &field) {
+      MoveLogHeader header;
+      header.n = n;
+      header.m = m;
+      header.first_tick = tick;
+      this->m = m;
+      previous_tick = tick;
+      std::fwrite(&header, sizeof(header), 1, out);
+      for (size_t x = 0; x < n; ++x) {
+        std::fwrite(&field[x][0], 1, m, out);
+      }
+    }
+
+    // Cell (x, y) swapped contents with its neighbour in direction dir
+    void swap(size_t x, size_t y, size_t dir) {
+      int64_t cell = static_cast<int64_t>(x * m + y);
+      swaps.push_back(zigzag(cell - previous_cell) << 2 | dir);
+      previous_cell = cell;
+    }
+
+    // Closes the tick, a record is written when anything moved
+    void end_tick(size_t tick, bool moved) {
+      if (moved) {
+        put_varint(buffer, tick - previous_tick);
+        put_varint(buffer, swaps.size());
+        for (uint64_t swap : swaps) {
+          put_varint(buffer, swap);
+        }
+        previous_tick = tick;
+        if (buffer.size() >= flush_size) {
+          flush();
+        }
+      }
+      swaps.clear();
+      previous_cell = 0;
+    }
+
+    void flush() {
+      if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+        throw std::runtime_error("Failed to write " + path);
+      }
+      buffer.clear();
+      std::fflush(out);
+    }
+
+  private:
+    static constexpr size_t flush_size = 1 << 20;
+
+    std::string path;
+    std::FILE *out;
+    size_t m = 0;
+    size_t previous_tick = 0;
+    int64_t previous_cell = 0;
+    std::vector<uint64_t> swaps;
+    std::vector<uint8_t> buffer;
+};
+
+// Sequential decoder of a move log, applies each record to its own copy of the field
+class MoveLogReader {
+  public:
+    explicit MoveLogReader(const std::string &path) : path(path), file(path) {
+      if (file.size() < sizeof(MoveLogHeader)) {
+        throw std::runtime_error(path + " is not a move log");
+      }
+      std::memcpy(&header, file.data(), sizeof(header));
+      if (header.magic != move_log_magic || header.version != move_log_version) {
+        throw std::runtime_error(path + " is not a version " + std::to_string(move_log_version) + " move log");
+      }
+      size_t cells = static_cast<size_t>(header.n) * header.m;
+      if (file.size() < sizeof(header) + cells) {
+        throw std::runtime_error(path + " is truncated");
+      }
+      const char *start = file.data() + sizeof(header);
+      for (size_t x = 0; x < header.n; ++x) {
+        field.emplace_back(start + x * header.m, header.m);
+      }
+      cursor = sizeof(header) + cells;
+      current_tick = header.first_tick;
+    }
+
+    // Applies the next record, false at the end of the log (or at a record cut short by a crash)
+    bool next() {
+      size_t position = cursor;
+      uint64_t tick_delta, count;
+      if (!get_varint(position, tick_delta) || !get_varint(position, count)) {
+        return false;
+      }
+      int64_t cell = 0;
+      size_t after = position;
+      for (uint64_t i = 0; i < count; i++) {
+        uint64_t swap;
+        if (!get_varint(after, swap)) {
+          return false;
+        }
+      }
+      for (uint64_t i = 0; i < count; i++) {
+        uint64_t swap;
+        get_varint(position, swap);
+        cell += unzigzag(swap >> 2);
+        size_t x = cell / header.m, y = cell % header.m;
+        auto [dx, dy] = deltas[swap & 3];
+        if (x >= header.n || x + dx >= header.n || y + dy >= header.m) {
+          throw std::runtime_error(path + ": swap outside of the field");
+        }
+        std::swap(field[x][y], field[x + dx][y + dy]);
+      }
+      cursor = position;
+      current_tick += tick_delta;
+      return true;
+    }
+
+    // Tick of the next record, false at the end of the log
+    bool peek(size_t &next_tick) const {
+      size_t position = cursor;
+      uint64_t tick_delta;
+      if (!get_varint(position, tick_delta)) {
+        return false;
+      }
+      next_tick = current_tick + tick_delta;
+      return true;
+    }
+
+    // Tick of the last applied record
+    size_t tick() const { return current_tick; }
+    const std::vector<std::string> &cells() const { return field; }
+    const MoveLogHeader &info() const { return header; }
+
+  private:
+    bool get_varint(size_t &position, uint64_t &value) const {
+      value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        if (position >= file.size()) {
+          return false;
+        }
+        uint8_t byte = static_cast<uint8_t>(file.data()[position++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    std::string path;
+    MappedFile file;
+    MoveLogHeader header;
+    std::vector<std::string> field;
+    size_t cursor = 0;
+    size_t current_tick = 0;
+};
+
+#endif // MOVE_LOG_HPP
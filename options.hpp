@@ -0,0 +1,215 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "frame_writer.hpp"
+#include "rng.hpp"
+
+struct Options {
+  std::string p_type;
+  std::string v_type;
+  std::string v_flow_type;
+
+  // scene file, text or binary, see scene.hpp
+  std::string input = "input.txt";
+
+  // run until this many ticks are done, or until one of the limits below ends it earlier
+  size_t ticks = 1'000'000;
+  // seconds of wall time, 0 for no limit
+  double max_wall_time = 0;
+  // stop after steady_ticks ticks in a row without movement and |total_delta_p| at most
+  // steady_delta_p, 0 ticks for never
+  size_t steady_ticks = 0;
+  double steady_delta_p = 0;
+
+  // write a checkpoint every checkpoint_every ticks when set
+  std::string checkpoint;
+  size_t checkpoint_every = 10'000;
+  // keep every checkpoint as <checkpoint>.<tick> instead of overwriting one file
+  bool checkpoint_keep = false;
+  // continue from this checkpoint instead of loading the scene
+  std::string resume;
+
+  FrameOptions frames;
+  // threads for the per-cell phases, 0 for one per core
+  size_t threads = 1;
+
+  // binary log of every move, see move_log.hpp
+  std::string move_log;
+
+  // random number policy of the move phase (see rng.hpp) and its seed, a resumed run keeps
+  // the policy and state of its checkpoint
+  std::string rng = LegacyRng::name;
+  uint64_t seed = 1337;
+  // move phase in row bands on the thread pool, needs a counter-based rng
+  bool parallel_move = false;
+
+  // per-tick state hashes, and the full state right after tick dump_tick when dump_state is
+  // set, see state_hash.hpp
+  std::string trace;
+  std::string dump_state;
+  size_t dump_tick = 0;
+
+  // per-phase times and search counters summed over every stats_every ticks, see phase_stats.hpp
+  std::string stats;
+  size_t stats_every = 100;
+  // add hardware cache miss and branch mispredict counts to the stats
+  bool perf_counters = false;
+
+  // manifest of independent runs, see ensemble.hpp, and where their results go (stdout when
+  // empty); --threads then counts concurrent jobs
+  std::string ensemble;
+  std::string ensemble_results;
+
+  // use the vector kernels of simd.hpp when the CPU has them, off for comparing against the
+  // scalar loops
+  bool simd = true;
+};
+
+inline void print_usage(const char *program) {
+  std::cerr << "Usage: " << program << " --p-type=... --v-type=... --v-flow-type=... [--input=path]\n"
+      << "  [--ticks=count] [--max-wall-time=seconds] [--steady-ticks=count] [--steady-delta-p=value]\n"
+      << "  [--checkpoint=path] [--checkpoint-every=ticks] [--checkpoint-keep] [--resume=path]\n"
+      << "  [--no-frames] [--frame-every=ticks] [--max-fps=fps] [--roi=x0,y0,x1,y1] [--output=path]"
+      << " [--frame-drop]\n"
+      << "  [--move-log=path] [--threads=count] [--rng=legacy|philox|xoshiro] [--seed=number]\n"
+      << "  [--parallel-move] [--stats=path.csv|path.json] [--stats-every=ticks] [--perf-counters]\n"
+      << "  [--simd=auto|scalar] [--ensemble=manifest] [--ensemble-results=path.csv]\n"
+      << "  [--trace=path] [--dump-state=path] [--dump-tick=tick]\n";
+}
+
+// Parses --key=value arguments, returns false (after printing the reason) on bad input
+inline bool parse_options(int argc, char **argv, Options &options) {
+  std::unordered_map<std::string, std::string> arg_map;
+  for (int i = 1; i < argc; i++) {
+    std::string arg_str = argv[i];
+    size_t eq_pos = arg_str.find('=');
+    std::string key = arg_str.substr(0, eq_pos);
+    std::string value = eq_pos == std::string::npos ? "" : arg_str.substr(eq_pos + 1);
+    arg_map[key] = value;
+  }
+
+  if (arg_map.find("--p-type") == arg_map.end() || arg_map.find("--v-type") == arg_map.end() || arg_map.
+    find("--v-flow-type") == arg_map.end()) {
+    std::cerr << "Missing required argument\n";
+    return false;
+  }
+
+  try {
+    for (const auto &[key, value] : arg_map) {
+      if (key == "--p-type") {
+        options.p_type = value;
+      } else if (key == "--v-type") {
+        options.v_type = value;
+      } else if (key == "--v-flow-type") {
+        options.v_flow_type = value;
+      } else if (key == "--input") {
+        options.input = value;
+      } else if (key == "--ticks") {
+        options.ticks = std::stoull(value);
+      } else if (key == "--max-wall-time") {
+        options.max_wall_time = std::stod(value);
+      } else if (key == "--steady-ticks") {
+        options.steady_ticks = std::stoull(value);
+      } else if (key == "--steady-delta-p") {
+        options.steady_delta_p = std::stod(value);
+      } else if (key == "--checkpoint") {
+        options.checkpoint = value;
+      } else if (key == "--checkpoint-every") {
+        options.checkpoint_every = std::stoull(value);
+      } else if (key == "--checkpoint-keep") {
+        options.checkpoint_keep = true;
+      } else if (key == "--resume") {
+        options.resume = value;
+      } else if (key == "--no-frames") {
+        options.frames.enabled = false;
+      } else if (key == "--frame-every") {
+        options.frames.every = std::stoull(value);
+      } else if (key == "--max-fps") {
+        options.frames.max_fps = std::stod(value);
+      } else if (key == "--roi") {
+        auto &region = options.frames.region;
+        char comma;
+        std::istringstream list(value);
+        if (!(list >> region.x0 >> comma >> region.y0 >> comma >> region.x1 >> comma >> region.y1) || region.empty()) {
+          std::cerr << "--roi expects x0,y0,x1,y1\n";
+          return false;
+        }
+      } else if (key == "--output") {
+        options.frames.path = value;
+      } else if (key == "--frame-drop") {
+        options.frames.drop = true;
+      } else if (key == "--threads") {
+        options.threads = std::stoull(value);
+      } else if (key == "--rng") {
+        if (value != LegacyRng::name && value != PhiloxRng::name && value != XoshiroRng::name) {
+          std::cerr << "--rng expects legacy, philox or xoshiro\n";
+          return false;
+        }
+        options.rng = value;
+      } else if (key == "--seed") {
+        options.seed = std::stoull(value);
+      } else if (key == "--parallel-move") {
+        options.parallel_move = true;
+      } else if (key == "--stats") {
+        options.stats = value;
+      } else if (key == "--stats-every") {
+        options.stats_every = std::stoull(value);
+      } else if (key == "--perf-counters") {
+        options.perf_counters = true;
+      } else if (key == "--simd") {
+        if (value != "auto" && value != "scalar") {
+          std::cerr << "--simd expects auto or scalar\n";
+          return false;
+        }
+        options.simd = value == "auto";
+      } else if (key == "--trace") {
+        options.trace = value;
+      } else if (key == "--dump-state") {
+        options.dump_state = value;
+      } else if (key == "--dump-tick") {
+        options.dump_tick = std::stoull(value);
+      } else if (key == "--ensemble") {
+        options.ensemble = value;
+      } else if (key == "--ensemble-results") {
+        options.ensemble_results = value;
+      } else if (key == "--move-log") {
+        options.move_log = value;
+      } else {
+        std::cerr << "Unknown argument " << key << "\n";
+        return false;
+      }
+    }
+  } catch (const std::logic_error &) {
+    std::cerr << "Bad numeric argument\n";
+    return false;
+  }
+  if (options.checkpoint_every == 0 || options.frames.every == 0 || options.stats_every == 0) {
+    std::cerr << "--checkpoint-every, --frame-every and --stats-every must be positive\n";
+    return false;
+  }
+  if (options.max_wall_time < 0 || options.steady_delta_p < 0) {
+    std::cerr << "--max-wall-time and --steady-delta-p must not be negative\n";
+    return false;
+  }
+  if (!options.dump_state.empty() && options.trace.empty()) {
+    std::cerr << "--dump-state needs --trace\n";
+    return false;
+  }
+  if (options.parallel_move && options.rng != PhiloxRng::name) {
+    std::cerr << "--parallel-move needs --rng=philox\n";
+    return false;
+  }
+  if (options.threads == 0) {
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return true;
+}
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,269 @@
+#ifndef PHASE_STATS_HPP
+#define PHASE_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Per-phase instrumentation of Simulator::execute. Building with -DFLUID_STATS=0 turns every
+// hook into a no-op, including the extra counters of the flow and move searches.
+#ifndef FLUID_STATS
+#define FLUID_STATS 1
+#endif
+
+constexpr bool stats_enabled = FLUID_STATS;
+
+enum class Phase : size_t {
+  Gravity,
+  Pressure,
+  Flow,
+  Kinetic,
+  Move,
+  // frames and the move log
+  Output,
+};
+
+constexpr size_t phase_count = 6;
+constexpr std::array<const char *, phase_count> phase_names{"gravity", "pressure", "flow", "kinetic", "move", "output"};
+
+// Work done by the flow phase of the last tick
+struct FlowStats {
+  size_t rounds = 0;
+  // cells with capacity left at the start of the phase
+  size_t cells = 0;
+  // propagate_flow visits over all rounds
+  size_t visited = 0;
+  // searches started and the deepest one, in cells
+  size_t calls = 0;
+  size_t depth = 0;
+};
+
+// Work done by the move phase of the last tick
+struct MoveStats {
+  // cells visited by move searches (the propagate_move calls of the recursive version) and
+  // the longest chain
+  size_t calls = 0;
+  size_t depth = 0;
+  // particles swapped
+  size_t moved = 0;
+};
+
+// Hardware cache misses and branch mispredicts of the calling thread, through perf_event_open.
+// Not every machine or container allows it, available() says whether it worked.
+class PerfCounters {
+  public:
+    static constexpr size_t count = 2;
+    static constexpr std::array<const char *, count> names{"cache_misses", "branch_misses"};
+
+    PerfCounters() {
+#ifdef __linux__
+      constexpr std::array<uint64_t, count> events{PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+      for (size_t i = 0; i < count; i++) {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = events[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+      }
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+      for (int fd : fds) {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+#endif
+    }
+
+    bool available() const {
+      for (int fd : fds) {
+        if (fd < 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    std::array<uint64_t, count> read() const {
+      std::array<uint64_t, count> values{};
+#ifdef __linux__
+      for (size_t i = 0; i < count; i++) {
+        if (::read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+          values[i] = 0;
+        }
+      }
+#endif
+      return values;
+    }
+
+  private:
+    std::array<int, count> fds{-1, -1};
+};
+
+// Collects the phase times and search counters of every tick and writes their sums every
+// `every` ticks as one row: CSV, or JSON lines when the path ends in .json
+class PhaseStats {
+  public:
+    PhaseStats(const std::string &path, size_t every, bool perf_counters)
+      : out(path), json(path.ends_with(".json")), every(every) {
+      if (!out) {
+        throw std::runtime_error("Failed to open " + path);
+      }
+      if (perf_counters) {
+        perf = std::make_unique<PerfCounters>();
+        if (!perf->available()) {
+          std::cerr << "Hardware counters are not available here, writing stats without them\n";
+          perf.reset();
+        }
+      }
+      if (!json) {
+        out << "first_tick,last_tick";
+        for (const char *phase : phase_names) {
+          out << "," << phase << "_ms";
+        }
+        out << ",flow_rounds,flow_calls,flow_visits,flow_max_depth,move_calls,move_max_depth,moved";
+        if (perf) {
+          for (const char *phase : phase_names) {
+            for (const char *counter : PerfCounters::names) {
+              out << "," << phase << "_" << counter;
+            }
+          }
+        }
+        out << "\n";
+      }
+    }
+
+    PhaseStats(const PhaseStats &) = delete;
+    PhaseStats &operator=(const PhaseStats &) = delete;
+
+    ~PhaseStats() {
+      write();
+    }
+
+    // Ends the phase running so far and starts `phase`
+    void enter(Phase phase) {
+      stop_phase();
+      current = static_cast<size_t>(phase);
+    }
+
+    // Ends the last phase of `tick` and adds the tick to the interval
+    void end_tick(size_t tick, const FlowStats &flow, const MoveStats &move) {
+      stop_phase();
+      current = phase_count;
+      if (ticks == 0) {
+        first_tick = tick;
+      }
+      last_tick = tick;
+      ticks++;
+      flow_rounds += flow.rounds;
+      flow_calls += flow.calls;
+      flow_visits += flow.visited;
+      flow_depth = std::max(flow_depth, flow.depth);
+      move_calls += move.calls;
+      move_depth = std::max(move_depth, move.depth);
+      moved += move.moved;
+      if (ticks == every) {
+        write();
+      }
+    }
+
+  private:
+    void stop_phase() {
+      auto now = std::chrono::steady_clock::now();
+      std::array<uint64_t, PerfCounters::count> counters{};
+      if (perf) {
+        counters = perf->read();
+      }
+      if (current < phase_count) {
+        ns[current] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count();
+        for (size_t i = 0; i < counters.size(); i++) {
+          perf_totals[current][i] += counters[i] - perf_since[i];
+        }
+      }
+      since = now;
+      perf_since = counters;
+    }
+
+    void write() {
+      if (ticks == 0) {
+        return;
+      }
+      if (json) {
+        out << "{\"first_tick\": " << first_tick << ", \"last_tick\": " << last_tick;
+        for (size_t i = 0; i < phase_count; i++) {
+          out << ", \"" << phase_names[i] << "_ms\": " << ns[i] / 1e6;
+        }
+        out << ", \"flow_rounds\": " << flow_rounds << ", \"flow_calls\": " << flow_calls << ", \"flow_visits\": "
+            << flow_visits << ", \"flow_max_depth\": " << flow_depth << ", \"move_calls\": " << move_calls
+            << ", \"move_max_depth\": " << move_depth << ", \"moved\": " << moved;
+        if (perf) {
+          for (size_t i = 0; i < phase_count; i++) {
+            for (size_t j = 0; j < PerfCounters::count; j++) {
+              out << ", \"" << phase_names[i] << "_" << PerfCounters::names[j] << "\": " << perf_totals[i][j];
+            }
+          }
+        }
+        out << "}\n";
+      } else {
+        out << first_tick << "," << last_tick;
+        for (uint64_t time : ns) {
+          out << "," << time / 1e6;
+        }
+        out << "," << flow_rounds << "," << flow_calls << "," << flow_visits << "," << flow_depth << ","
+            << move_calls << "," << move_depth << "," << moved;
+        if (perf) {
+          for (const auto &phase : perf_totals) {
+            for (uint64_t value : phase) {
+              out << "," << value;
+            }
+          }
+        }
+        out << "\n";
+      }
+      out.flush();
+      ticks = 0;
+      ns = {};
+      perf_totals = {};
+      flow_rounds = flow_calls = flow_visits = flow_depth = 0;
+      move_calls = move_depth = moved = 0;
+    }
+
+    std::ofstream out;
+    bool json;
+    size_t every;
+    std::unique_ptr<PerfCounters> perf;
+
+    // phase running now, phase_count between ticks
+    size_t current = phase_count;
+    std::chrono::steady_clock::time_point since;
+    std::array<uint64_t, PerfCounters::count> perf_since{};
+
+    // sums over the ticks of the current interval
+    size_t ticks = 0;
+    size_t first_tick = 0, last_tick = 0;
+    std::array<uint64_t, phase_count> ns{};
+    std::array<std::array<uint64_t, PerfCounters::count>, phase_count> perf_totals{};
+    size_t flow_rounds = 0, flow_calls = 0, flow_visits = 0, flow_depth = 0;
+    size_t move_calls = 0, move_depth = 0, moved = 0;
+};
+
+#endif // PHASE_STATS_HPP
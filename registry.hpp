@@ -0,0 +1,141 @@
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "fixed.hpp"
+#include "options.hpp"
+
+// Spellings of the TYPES and SIZES lists
+#define FLOAT            float
+#define DOUBLE           double
+#define FAST_FIXED(N, K) Fixed<N, K, true>
+#define FIXED(N, K)      Fixed<N, K>
+#define S(N, M)          Size<N, M>
+
+#ifndef TYPES
+#define TYPES FLOAT, DOUBLE, FIXED(32, 16), FAST_FIXED(16, 8)
+#endif
+
+template<typename... Ts>
+struct TypeList {
+  static constexpr size_t size = sizeof...(Ts);
+};
+
+template<size_t N, size_t M>
+struct Size {
+};
+
+// Calls fn.template operator()<N, M>() for the first listed size equal to (n, m), falls back to
+// the dynamic-size version <0, 0> when none matches
+template<typename Fn, size_t... N, size_t... M>
+void with_static_size(size_t n, size_t m, TypeList<Size<N, M>...>, Fn &&fn) {
+  bool found = ((n == N && m == M && (fn.template operator()<N, M>(), true)) || ...);
+  if (!found) {
+    fn.template operator()<0, 0>();
+  }
+}
+
+// Combinations Simulator can be instantiated with: every type of TYPES converts into every
+// other one, so any triple works
+template<typename PType, typename VType, typename VFlowType>
+constexpr bool is_supported_combination = true;
+
+using SimulationRunner = void (*)(const Options &);
+
+struct RegistryEntry {
+  std::string p_type;
+  std::string v_type;
+  std::string v_flow_type;
+  // nullptr for combinations that are listed in TYPES but not supported
+  SimulationRunner run;
+};
+
+// Instantiates Job<PType, VType, VFlowType>::run for every triple from Ts^3
+template<template<typename, typename, typename> class Job, typename... Ts>
+class SimulatorRegistry {
+  public:
+    static const std::vector<RegistryEntry> &entries() {
+      static const std::vector<RegistryEntry> entries = make_entries(std::make_index_sequence<N * N * N>());
+      return entries;
+    }
+
+    static std::vector<std::string> type_names() {
+      return {TypeName<Ts>::get()...};
+    }
+
+  private:
+    static constexpr size_t N = sizeof...(Ts);
+
+    template<size_t I>
+    using At = std::tuple_element_t<I, std::tuple<Ts...> >;
+
+    template<size_t I>
+    static RegistryEntry make_entry() {
+      using PType = At<I / (N * N)>;
+      using VType = At<I / N % N>;
+      using VFlowType = At<I % N>;
+      SimulationRunner run = nullptr;
+      if constexpr (is_supported_combination<PType, VType, VFlowType>) {
+        run = &Job<PType, VType, VFlowType>::run;
+      }
+      return {TypeName<PType>::get(), TypeName<VType>::get(), TypeName<VFlowType>::get(), run};
+    }
+
+    template<size_t... I>
+    static std::vector<RegistryEntry> make_entries(std::index_sequence<I...>) {
+      return {make_entry<I>()...};
+    }
+};
+
+template<template<typename, typename, typename> class Job, typename... Ts>
+auto make_registry(TypeList<Ts...>) {
+  return SimulatorRegistry<Job, Ts...>();
+}
+
+// Type names are compared with whitespace removed, so "FIXED(32, 16)" matches "FIXED(32,16)"
+inline std::string normalize_type_name(std::string name) {
+  std::erase_if(name, [](unsigned char c) { return std::isspace(c); });
+  return name;
+}
+
+// Runs the simulation for the requested types, returns false (after printing the reason) if
+// the combination is unknown or unsupported
+template<typename Registry>
+bool dispatch(const Registry &registry, const Options &options) {
+  std::string p_type = normalize_type_name(options.p_type);
+  std::string v_type = normalize_type_name(options.v_type);
+  std::string v_flow_type = normalize_type_name(options.v_flow_type);
+
+  auto names = registry.type_names();
+  for (const auto &name : {p_type, v_type, v_flow_type}) {
+    if (std::ranges::find(names, name) == names.end()) {
+      std::cerr << "Unknown type " << name << ", available types:";
+      for (const auto &available : names) {
+        std::cerr << " " << available;
+      }
+      std::cerr << "\n";
+      return false;
+    }
+  }
+
+  for (const auto &entry : registry.entries()) {
+    if (entry.p_type == p_type && entry.v_type == v_type && entry.v_flow_type == v_flow_type) {
+      if (entry.run == nullptr) {
+        std::cerr << "Unsupported type combination: --p-type=" << p_type << " --v-type=" << v_type
+            << " --v-flow-type=" << v_flow_type << "\n";
+        return false;
+      }
+      entry.run(options);
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif // REGISTRY_HPP
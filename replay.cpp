@@ -0,0 +1,90 @@
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include "frame_writer.hpp"
+#include "move_log.hpp"
+
+// Rebuilds "Tick i:" frames from a --move-log file without running the simulation
+struct ReplayOptions {
+  std::string log;
+  size_t from = 0;
+  size_t to = std::numeric_limits<size_t>::max();
+  FrameOptions frames;
+};
+
+static void print_replay_usage(const char *program) {
+  std::cerr << "Usage: " << program << " <move log> [--from=tick] [--to=tick] [--tick=tick]"
+      << " [--roi=x0,y0,x1,y1] [--output=path]\n"
+      << "  --tick prints only the field as it was after that tick\n";
+}
+
+static bool parse_replay_options(int argc, char **argv, ReplayOptions &options, bool &single) {
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      size_t eq_pos = arg.find('=');
+      std::string key = arg.substr(0, eq_pos);
+      std::string value = eq_pos == std::string::npos ? "" : arg.substr(eq_pos + 1);
+      if (key.rfind("--", 0) != 0) {
+        options.log = arg;
+      } else if (key == "--from") {
+        options.from = std::stoull(value);
+      } else if (key == "--to") {
+        options.to = std::stoull(value);
+      } else if (key == "--tick") {
+        options.from = options.to = std::stoull(value);
+        single = true;
+      } else if (key == "--roi") {
+        auto &region = options.frames.region;
+        char comma;
+        std::istringstream list(value);
+        if (!(list >> region.x0 >> comma >> region.y0 >> comma >> region.x1 >> comma >> region.y1) || region.empty()) {
+          std::cerr << "--roi expects x0,y0,x1,y1\n";
+          return false;
+        }
+      } else if (key == "--output") {
+        options.frames.path = value;
+      } else {
+        std::cerr << "Unknown argument " << key << "\n";
+        return false;
+      }
+    }
+  } catch (const std::logic_error &) {
+    std::cerr << "Bad numeric argument\n";
+    return false;
+  }
+  return !options.log.empty();
+}
+
+int main(int argc, char **argv) {
+  ReplayOptions options;
+  bool single = false;
+  if (!parse_replay_options(argc, argv, options, single)) {
+    print_replay_usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    MoveLogReader reader(options.log);
+    FrameWriter frames(options.frames, reader.info().n, reader.info().m);
+    if (single) {
+      // the field at a tick is the one left by the last record up to it
+      size_t next_tick;
+      while (reader.peek(next_tick) && next_tick <= options.to) {
+        reader.next();
+      }
+      frames.on_tick(options.to, true, reader.cells());
+      return 0;
+    }
+    while (reader.next() && reader.tick() <= options.to) {
+      if (reader.tick() >= options.from) {
+        frames.on_tick(reader.tick(), true, reader.cells());
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,225 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
+
+// Random number policies for the move phase. Every draw names what it is for: the tick, the
+// cell, a stream (which decision of that cell) and an index within the stream. Counter-based
+// policies derive the bits from that key alone, so the outcome does not depend on the order
+// cells are visited in; sequential ones ignore the key and hand out their next number.
+
+enum RngStream : uint32_t {
+  // whether the particle of a cell tries to move
+  MoveStart = 0,
+  // direction chosen by a cell of a move chain, one draw per attempt
+  MoveDirection = 1,
+};
+
+// Yields fixed bits through the random bit generator interface, so Fixed(rnd) style
+// constructors see exactly the word a policy produced
+struct RandomBits {
+  using result_type = uint32_t;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT32_MAX; }
+  result_type operator()() const { return bits; }
+
+  uint32_t bits;
+};
+
+// Uniform value in [0, 1) made from 32 random bits the same way the reference Fixed(rnd) does
+template<typename Type>
+Type random01(uint32_t bits) {
+  if constexpr (std::is_floating_point_v<Type>) {
+    return static_cast<Type>(bits & ((1 << 16) - 1)) / static_cast<Type>(1 << 16);
+  } else {
+    RandomBits source{bits};
+    return Type(source);
+  }
+}
+
+// The reference generator: one std::mt19937 shared by all draws in visiting order
+class LegacyRng {
+  public:
+    static constexpr const char *name = "legacy";
+    static constexpr bool counter_based = false;
+
+    explicit LegacyRng(uint64_t seed) : rnd(static_cast<uint32_t>(seed)) {
+    }
+
+    uint32_t bits(uint64_t, uint64_t, uint32_t, uint32_t) {
+      return rnd();
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const LegacyRng &rng) {
+      return out << rng.rnd;
+    }
+
+    friend std::istream &operator>>(std::istream &in, LegacyRng &rng) {
+      return in >> rng.rnd;
+    }
+
+  private:
+    std::mt19937 rnd;
+};
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"), keyed by the
+// seed with the draw key as counter. Stateless between draws.
+class PhiloxRng {
+  public:
+    static constexpr const char *name = "philox";
+    static constexpr bool counter_based = true;
+
+    explicit PhiloxRng(uint64_t seed) : seed(seed) {
+    }
+
+    uint32_t bits(uint64_t tick, uint64_t cell, uint32_t stream, uint32_t index) const {
+      std::array<uint32_t, 4> counter{
+        static_cast<uint32_t>(cell), static_cast<uint32_t>(cell >> 32) ^ stream << 24,
+        static_cast<uint32_t>(tick), static_cast<uint32_t>(tick >> 32) ^ index
+      };
+      uint32_t key0 = static_cast<uint32_t>(seed), key1 = static_cast<uint32_t>(seed >> 32);
+      for (int round = 0; round < 10; round++) {
+        uint64_t product0 = uint64_t{0xD2511F53} * counter[0];
+        uint64_t product1 = uint64_t{0xCD9E8D57} * counter[2];
+        counter = {
+          static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key0, static_cast<uint32_t>(product1),
+          static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key1, static_cast<uint32_t>(product0)
+        };
+        key0 += 0x9E3779B9;
+        key1 += 0xBB67AE85;
+      }
+      return counter[0];
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const PhiloxRng &rng) {
+      return out << rng.seed;
+    }
+
+    friend std::istream &operator>>(std::istream &in, PhiloxRng &rng) {
+      return in >> rng.seed;
+    }
+
+  private:
+    uint64_t seed;
+};
+
+// xoshiro128++ (Blackman and Vigna) filling a block of numbers at a time. Sequential like the
+// legacy generator, but much cheaper per draw.
+class XoshiroRng {
+  public:
+    static constexpr const char *name = "xoshiro";
+    static constexpr bool counter_based = false;
+
+    explicit XoshiroRng(uint64_t seed) {
+      // splitmix64 spreads the seed over the whole state
+      for (size_t i = 0; i < state.size(); i += 2) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        z ^= z >> 31;
+        state[i] = static_cast<uint32_t>(z);
+        state[i + 1] = static_cast<uint32_t>(z >> 32);
+      }
+    }
+
+    uint32_t bits(uint64_t, uint64_t, uint32_t, uint32_t) {
+      if (position == block.size()) {
+        refill();
+      }
+      return block[position++];
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const XoshiroRng &rng) {
+      for (uint32_t word : rng.state) {
+        out << word << ' ';
+      }
+      out << rng.position;
+      for (size_t i = rng.position; i < rng.block.size(); i++) {
+        out << ' ' << rng.block[i];
+      }
+      return out;
+    }
+
+    friend std::istream &operator>>(std::istream &in, XoshiroRng &rng) {
+      for (uint32_t &word : rng.state) {
+        in >> word;
+      }
+      in >> rng.position;
+      if (rng.position > rng.block.size()) {
+        in.setstate(std::ios::failbit);
+        return in;
+      }
+      for (size_t i = rng.position; i < rng.block.size(); i++) {
+        in >> rng.block[i];
+      }
+      return in;
+    }
+
+  private:
+    static uint32_t rotl(uint32_t x, int k) {
+      return (x << k) | (x >> (32 - k));
+    }
+
+    void refill() {
+      for (uint32_t &word : block) {
+        word = rotl(state[0] + state[3], 7) + state[0];
+        uint32_t t = state[1] << 9;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 11);
+      }
+      position = 0;
+    }
+
+    std::array<uint32_t, 4> state{};
+    std::array<uint32_t, 64> block{};
+    size_t position = block.size();
+};
+
+using Rng = std::variant<LegacyRng, PhiloxRng, XoshiroRng>;
+
+inline Rng make_rng(const std::string &name, uint64_t seed) {
+  if (name == PhiloxRng::name) {
+    return PhiloxRng(seed);
+  }
+  if (name == XoshiroRng::name) {
+    return XoshiroRng(seed);
+  }
+  if (name == LegacyRng::name) {
+    return LegacyRng(seed);
+  }
+  throw std::invalid_argument("Unknown random generator " + name);
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Rng &rng) {
+  std::visit([&](const auto &policy) { out << policy.name << ' ' << policy; }, rng);
+  return out;
+}
+
+inline std::istream &operator>>(std::istream &in, Rng &rng) {
+  std::string name;
+  if (!(in >> name)) {
+    return in;
+  }
+  try {
+    rng = make_rng(name, 0);
+  } catch (const std::invalid_argument &) {
+    in.setstate(std::ios::failbit);
+    return in;
+  }
+  std::visit([&](auto &policy) { in >> policy; }, rng);
+  return in;
+}
+
+#endif // RNG_HPP
@@ -0,0 +1,301 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "fixed.hpp"
+#include "mapped_file.hpp"
+
+// Factor the kinetic phase scales a material's pressure gain by when the scene does not say:
+// 0.8 for '.', the reference special case, 1 for everything else
+inline std::array<double, 256> default_damping() {
+  std::array<double, 256> damping;
+  damping.fill(1);
+  damping['.'] = 0.8;
+  return damping;
+}
+
+// Input scene before conversion to any particular numeric type
+struct Scene {
+  int n = 0;
+  int m = 0;
+  double g = 0;
+  std::array<double, 256> rho{};
+  std::array<double, 256> damping = default_damping();
+  FieldStorageType field;
+};
+
+// Scenes come in two formats, told apart by the first bytes of the file.
+//
+// Text:
+//   n m g
+//   k
+//   k lines c=rho or c=rho damping, c being any cell character including ' '
+//   n lines of exactly m cells
+// Line ends may be "\n" or "\r\n", the last row may miss its line end.
+//
+// Binary, for scenes too large to parse quickly:
+//   header  magic "FLUIDSC\0", u32 version, u32 n, u32 m, u32 reserved, f64 g, f64 rho[256],
+//           f64 damping[256] (version 1 ends before damping and uses default_damping)
+//   cells   n * m chars, row-major
+
+constexpr std::array<char, 8> scene_magic{'F', 'L', 'U', 'I', 'D', 'S', 'C', '\0'};
+constexpr uint32_t scene_version = 2;
+// Largest n and m a scene may declare, keeps n * m and the per-cell layers addressable
+constexpr uint32_t max_scene_side = 1 << 16;
+
+struct SceneHeader {
+  std::array<char, 8> magic = scene_magic;
+  uint32_t version = scene_version;
+  uint32_t n = 0;
+  uint32_t m = 0;
+  uint32_t reserved = 0;
+  double g = 0;
+  std::array<double, 256> rho{};
+  std::array<double, 256> damping{};
+};
+
+constexpr size_t scene_header_v1_size = offsetof(SceneHeader, damping);
+
+inline void check_scene_size(const std::string &path, long n, long m) {
+  if (n <= 0 || m <= 0 || n > max_scene_side || m > max_scene_side) {
+    throw std::runtime_error(path + ": scene size " + std::to_string(n) + "x" + std::to_string(m) +
+                             " is outside 1.." + std::to_string(max_scene_side));
+  }
+}
+
+// Parses the text format straight out of the mapped file: every row is validated and copied
+// into the scene once, nothing else is buffered
+class TextSceneParser {
+  public:
+    TextSceneParser(const std::string &path, std::string_view text) : path(path), text(text) {
+    }
+
+    Scene parse() {
+      Scene scene;
+      long n = number<long>("n");
+      long m = number<long>("m");
+      scene.g = number<double>("g");
+      check_scene_size(path, n, m);
+      scene.n = static_cast<int>(n);
+      scene.m = static_cast<int>(m);
+      end_line();
+
+      long k = number<long>("material count");
+      if (k < 0 || k > 256) {
+        fail("material count " + std::to_string(k) + " is outside 0..256");
+      }
+      end_line();
+      for (long i = 0; i < k; i++) {
+        size_t start = pos;
+        std::string_view entry = line();
+        if (entry.size() < 3 || entry[1] != '=') {
+          fail("expected c=rho", start);
+        }
+        unsigned char cell = entry[0];
+        const char *last = entry.data() + entry.size();
+        auto [end, ec] = std::from_chars(entry.data() + 2, last, scene.rho[cell]);
+        if (ec != std::errc() || (end != last && *end != ' ')) {
+          fail("bad density " + std::string(entry.substr(2)), start);
+        }
+        if (end != last) {
+          auto [damping_end, damping_ec] = std::from_chars(end + 1, last, scene.damping[cell]);
+          if (damping_ec != std::errc() || damping_end != last) {
+            fail("bad damping " + std::string(end + 1, last), start);
+          }
+        }
+      }
+
+      scene.field.reserve(scene.n);
+      for (int x = 0; x < scene.n; x++) {
+        if (pos == text.size()) {
+          fail("expected " + std::to_string(scene.n) + " rows, found " + std::to_string(x));
+        }
+        size_t start = pos;
+        std::string_view row = line();
+        if (row.size() != static_cast<size_t>(scene.m)) {
+          fail("row " + std::to_string(x) + " has " + std::to_string(row.size()) + " cells, expected " +
+               std::to_string(scene.m), start);
+        }
+        scene.field.emplace_back(row);
+      }
+      for (; pos < text.size(); pos++) {
+        if (!std::isspace(static_cast<unsigned char>(text[pos]))) {
+          fail("unexpected data after the last row");
+        }
+      }
+      return scene;
+    }
+
+  private:
+    [[noreturn]] void fail(const std::string &what) const {
+      fail(what, pos);
+    }
+
+    [[noreturn]] void fail(const std::string &what, size_t at) const {
+      size_t line_number = 1 + std::count(text.begin(), text.begin() + static_cast<long>(at), '\n');
+      throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + what);
+    }
+
+    void skip_blanks() {
+      while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+        pos++;
+      }
+    }
+
+    template<typename Number>
+    Number number(const char *what) {
+      skip_blanks();
+      Number value{};
+      auto [end, ec] = std::from_chars(text.data() + pos, text.data() + text.size(), value);
+      if (ec != std::errc()) {
+        fail(std::string("expected ") + what);
+      }
+      pos = end - text.data();
+      return value;
+    }
+
+    // Skips the rest of the current line, which may only hold blanks
+    void end_line() {
+      while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r')) {
+        pos++;
+      }
+      if (pos < text.size() && text[pos] != '\n') {
+        fail("unexpected data at the end of the line");
+      }
+      pos++;
+    }
+
+    // Next line without its line end
+    std::string_view line() {
+      size_t end = text.find('\n', pos);
+      if (end == std::string_view::npos) {
+        end = text.size();
+      }
+      std::string_view result = text.substr(pos, end - pos);
+      if (!result.empty() && result.back() == '\r') {
+        result.remove_suffix(1);
+      }
+      pos = std::min(end + 1, text.size());
+      return result;
+    }
+
+    const std::string &path;
+    std::string_view text;
+    size_t pos = 0;
+};
+
+inline Scene parse_binary_scene(const std::string &path, std::string_view bytes) {
+  if (bytes.size() < scene_header_v1_size) {
+    throw std::runtime_error(path + ": truncated scene header");
+  }
+  SceneHeader header;
+  header.damping = default_damping();
+  std::memcpy(reinterpret_cast<char *>(&header), bytes.data(), scene_header_v1_size);
+  if (header.version != 1 && header.version != scene_version) {
+    throw std::runtime_error(path + " has scene version " + std::to_string(header.version) + ", expected " +
+                             std::to_string(scene_version));
+  }
+  size_t header_size = header.version == 1 ? scene_header_v1_size : sizeof(SceneHeader);
+  if (bytes.size() < header_size) {
+    throw std::runtime_error(path + ": truncated scene header");
+  }
+  std::memcpy(reinterpret_cast<char *>(&header), bytes.data(), header_size);
+  check_scene_size(path, header.n, header.m);
+  size_t cells = static_cast<size_t>(header.n) * header.m;
+  if (bytes.size() != header_size + cells) {
+    throw std::runtime_error(path + ": expected " + std::to_string(cells) + " cells after the header, found " +
+                             std::to_string(bytes.size() - header_size));
+  }
+
+  Scene scene;
+  scene.n = static_cast<int>(header.n);
+  scene.m = static_cast<int>(header.m);
+  scene.g = header.g;
+  scene.rho = header.rho;
+  scene.damping = header.damping;
+  scene.field.reserve(scene.n);
+  for (size_t x = 0; x < header.n; x++) {
+    scene.field.emplace_back(bytes.substr(header_size + x * header.m, header.m));
+  }
+  return scene;
+}
+
+inline Scene load_scene(const std::string &path = "input.txt") {
+  MappedFile file(path);
+  std::string_view bytes(file.data(), file.size());
+  if (bytes.starts_with(std::string_view(scene_magic.data(), scene_magic.size()))) {
+    return parse_binary_scene(path, bytes);
+  }
+  return TextSceneParser(path, bytes).parse();
+}
+
+inline void save_binary_scene(const std::string &path, const Scene &scene) {
+  SceneHeader header;
+  header.n = scene.n;
+  header.m = scene.m;
+  header.g = scene.g;
+  header.rho = scene.rho;
+  header.damping = scene.damping;
+  FILE *out = std::fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+  for (int x = 0; x < scene.n && ok; x++) {
+    std::string row = scene.field[x];
+    row.resize(scene.m, ' ');
+    ok = std::fwrite(row.data(), 1, row.size(), out) == row.size();
+  }
+  if (std::fclose(out) != 0 || !ok) {
+    throw std::runtime_error("Failed to write " + path);
+  }
+}
+
+// Shortest spelling that parses back to the same double
+inline std::string format_scene_number(double value) {
+  std::array<char, 32> buffer;
+  auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+  return {buffer.data(), end};
+}
+
+// Writes the text format, materials in character order
+inline void save_text_scene(const std::string &path, const Scene &scene) {
+  FILE *out = std::fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  size_t k = std::ranges::count_if(scene.rho, [](double rho) { return rho != 0; });
+  std::fprintf(out, "%d %d %s\n%zu\n", scene.n, scene.m, format_scene_number(scene.g).c_str(), k);
+  auto defaults = default_damping();
+  for (size_t c = 0; c < scene.rho.size(); c++) {
+    if (scene.rho[c] != 0) {
+      std::fprintf(out, "%c=%s", static_cast<char>(c), format_scene_number(scene.rho[c]).c_str());
+      if (scene.damping[c] != defaults[c]) {
+        std::fprintf(out, " %s", format_scene_number(scene.damping[c]).c_str());
+      }
+      std::fputc('\n', out);
+    }
+  }
+  bool ok = true;
+  for (int x = 0; x < scene.n && ok; x++) {
+    std::string row = scene.field[x];
+    row.resize(scene.m, ' ');
+    row += '\n';
+    ok = std::fwrite(row.data(), 1, row.size(), out) == row.size();
+  }
+  if (std::fclose(out) != 0 || !ok) {
+    throw std::runtime_error("Failed to write " + path);
+  }
+}
+
+#endif // SCENE_HPP
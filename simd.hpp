@@ -0,0 +1,158 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "fixed.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define FLUID_SIMD_X86 1
+#else
+#define FLUID_SIMD_X86 0
+#endif
+
+// Vector kernels for the per-cell loops. Each kernel has a scalar version doing the operations of
+// the original loop; the vector versions do the same operations lane by lane (integer adds on
+// the raw value for Fixed, IEEE adds for float and double) and use masks where the loop
+// branches, so every path gives the same bits. The instruction set is chosen at run time.
+
+enum class SimdLevel {
+  Scalar,
+  Avx2,
+};
+
+inline SimdLevel detect_simd_level() {
+#if FLUID_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::Avx2;
+  }
+#endif
+  return SimdLevel::Scalar;
+}
+
+// Level the kernels run at, the best one the CPU has unless lowered (--simd=scalar)
+inline SimdLevel simd_level = detect_simd_level();
+
+inline const char *simd_level_name(SimdLevel level) {
+  return level == SimdLevel::Avx2 ? "avx2" : "scalar";
+}
+
+// Lane type a Type is stored as in vector registers, void for types without a vector path.
+// Fixed adds are plain adds of the raw integers.
+template<typename Type>
+struct SimdLane {
+  using type = void;
+};
+
+template<>
+struct SimdLane<float> {
+  using type = float;
+};
+
+template<>
+struct SimdLane<double> {
+  using type = double;
+};
+
+template<int P, int Q, bool fast>
+struct SimdLane<Fixed<P, Q, fast> > {
+  using Storage = typename Fixed<P, Q, fast>::StorageType;
+  using type = std::conditional_t<sizeof(Storage) == 4, int32_t, std::conditional_t<sizeof(Storage) == 8, int64_t, void> >;
+};
+
+#if FLUID_SIMD_X86
+namespace simd_detail {
+  // Lanes whose cell byte has every bit of mask, widened to the lane size
+  __attribute__((target("avx2"))) inline __m256i cell_mask8(const uint8_t *cells, uint8_t mask) {
+    __m256i bits = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(cells)));
+    __m256i wanted = _mm256_set1_epi32(mask);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(bits, wanted), wanted);
+  }
+
+  __attribute__((target("avx2"))) inline __m256i cell_mask4(const uint8_t *cells, uint8_t mask) {
+    int32_t four;
+    std::memcpy(&four, cells, sizeof(four));
+    __m256i bits = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+    __m256i wanted = _mm256_set1_epi64x(mask);
+    return _mm256_cmpeq_epi64(_mm256_and_si256(bits, wanted), wanted);
+  }
+
+  // values[y] += add where the mask holds, y a multiple of the lane count below count; returns
+  // the first y left for the scalar tail
+  __attribute__((target("avx2"))) inline size_t add_where(float *values, const uint8_t *cells, uint8_t mask, float add,
+                                                          size_t count) {
+    __m256 step = _mm256_set1_ps(add);
+    size_t y = 0;
+    for (; y + 8 <= count; y += 8) {
+      __m256 v = _mm256_loadu_ps(values + y);
+      __m256 keep = _mm256_castsi256_ps(cell_mask8(cells + y, mask));
+      _mm256_storeu_ps(values + y, _mm256_blendv_ps(v, _mm256_add_ps(v, step), keep));
+    }
+    return y;
+  }
+
+  __attribute__((target("avx2"))) inline size_t add_where(double *values, const uint8_t *cells, uint8_t mask,
+                                                          double add, size_t count) {
+    __m256d step = _mm256_set1_pd(add);
+    size_t y = 0;
+    for (; y + 4 <= count; y += 4) {
+      __m256d v = _mm256_loadu_pd(values + y);
+      __m256d keep = _mm256_castsi256_pd(cell_mask4(cells + y, mask));
+      _mm256_storeu_pd(values + y, _mm256_blendv_pd(v, _mm256_add_pd(v, step), keep));
+    }
+    return y;
+  }
+
+  __attribute__((target("avx2"))) inline size_t add_where(int32_t *values, const uint8_t *cells, uint8_t mask,
+                                                          int32_t add, size_t count) {
+    __m256i step = _mm256_set1_epi32(add);
+    size_t y = 0;
+    for (; y + 8 <= count; y += 8) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + y));
+      __m256i sum = _mm256_add_epi32(v, _mm256_and_si256(step, cell_mask8(cells + y, mask)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + y), sum);
+    }
+    return y;
+  }
+
+  __attribute__((target("avx2"))) inline size_t add_where(int64_t *values, const uint8_t *cells, uint8_t mask,
+                                                          int64_t add, size_t count) {
+    __m256i step = _mm256_set1_epi64x(add);
+    size_t y = 0;
+    for (; y + 4 <= count; y += 4) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + y));
+      __m256i sum = _mm256_add_epi64(v, _mm256_and_si256(step, cell_mask4(cells + y, mask)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + y), sum);
+    }
+    return y;
+  }
+}
+#endif
+
+// values[y] += add for every y < count whose cells[y] has all bits of mask (gravity on a
+// contiguous row of one velocity direction)
+template<typename Type>
+void add_where(Type *values, const uint8_t *cells, uint8_t mask, Type add, size_t count) {
+  size_t y = 0;
+#if FLUID_SIMD_X86
+  using Lane = typename SimdLane<Type>::type;
+  if constexpr (!std::is_void_v<Lane>) {
+    if (simd_level == SimdLevel::Avx2) {
+      Lane raw_add;
+      std::memcpy(&raw_add, &add, sizeof(raw_add));
+      y = simd_detail::add_where(reinterpret_cast<Lane *>(values), cells, mask, raw_add, count);
+    }
+  }
+#endif
+  for (; y < count; y++) {
+    if ((cells[y] & mask) == mask) {
+      values[y] += add;
+    }
+  }
+}
+
+#endif // SIMD_HPP
@@ -1,110 +1,333 @@
 #ifndef SIMULATOR_HPP
 #define SIMULATOR_HPP
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "checkpoint.hpp"
 #include "fixed.hpp"
+#include "frame_writer.hpp"
+#include "generator.hpp"
+#include "move_log.hpp"
+#include "phase_stats.hpp"
+#include "rng.hpp"
+#include "scene.hpp"
+#include "simd.hpp"
+#include "state_hash.hpp"
+#include "thread_pool.hpp"
+#include "topology.hpp"
 
 using namespace std;
 
 constexpr size_t T = 1'000'000;
 
-template<typename PType, typename VType, typename VFlowType>
-class Simulator {
+// Why execute() returned before reaching its tick count
+enum class StopReason {
+  None,
+  // the fluid settled, see set_steady_state
+  Steady,
+  // the deadline of set_deadline passed
+  WallTime,
+};
+
+// Grid bounds: compile-time constants for the static-size specializations
+template<size_t N, size_t M>
+struct SimulatorExtents {
+  static constexpr int n = N, m = M;
+
+  SimulatorExtents(int, int) {
+  }
+};
+
+template<>
+struct SimulatorExtents<0, 0> {
+  int n, m;
+
+  SimulatorExtents(int n, int m): n(n), m(m) {
+  }
+};
+
+// N = M = 0 selects the dynamic-size version with runtime bounds
+template<
+  typename PType, typename VType, typename VFlowType, size_t N = 0, size_t M = 0,
+  GridLayout Layout = default_grid_layout
+>
+class Simulator : SimulatorExtents<N, M> {
+    using Extents = SimulatorExtents<N, M>;
+    using Extents::n;
+    using Extents::m;
+
   public:
-    explicit Simulator(
-      int n,
-      int m,
-      PType g,
-      const PType _rho[256],
-      FieldStorageType &_field
-    ): n(n), m(m), g(g) {
-      p = std::vector<std::vector<PType> >(n, std::vector<PType>(m));
-      old_p = std::vector<std::vector<PType> >(n, std::vector<PType>(m));
-      last_use = std::vector<std::vector<int> >(n, std::vector<int>(m));
-      dirs = std::vector<std::vector<int> >(n, std::vector<int>(m));
-      field = std::move(_field);
-      std::memcpy(rho, _rho, sizeof rho);
-
-      velocity = VectorField<VType>(n, m);
-      velocity_flow = VectorField<VFlowType>(n, m);
+    using TopologyType = Topology<N, M, Layout.padded>;
+    using FieldGrid = Grid<char, N, M, Layout.padded>;
+    using PressureGrid = Grid<PType, N, M, Layout.padded>;
+    using VelocityField = VectorField<VType, N, M, Layout>;
+
+    explicit Simulator(const Scene &scene)
+      : Simulator(scene, std::make_shared<const TopologyType>(scene.field, scene.n, scene.m)) {
+    }
+
+    // Walls never change, so Simulators of one scene can share a topology built from its field
+    Simulator(const Scene &scene, std::shared_ptr<const TopologyType> shared)
+      : Extents(scene.n, scene.m),
+        field(scene.n, scene.m),
+        velocity(scene.n, scene.m),
+        velocity_flow(scene.n, scene.m),
+        p(scene.n, scene.m),
+        old_p(scene.n, scene.m),
+        last_use(scene.n, scene.m),
+        shared_topology(std::move(shared)),
+        topology(*shared_topology),
+        row_delta_p(scene.n) {
+      assert(n == scene.n && m == scene.m);
+      set_constants(scene.g, scene.rho, scene.damping);
 
       for (int i = 0; i < n; i++) {
-        std::string row;
-        for (int j = 0; j < m; j++) {
-          char c = field[i][j];
-          row.push_back(c);
-        }
-        this->field.push_back(row);
+        const std::string &row = scene.field[i];
+        std::copy_n(row.begin(), std::min<size_t>(row.size(), m), field[i]);
+      }
+
+
+      size_t open_cells = topology.open_cells();
+      flow_stack.reserve(open_cells);
+      serial_scope.stop_stack.reserve(open_cells);
+      serial_scope.move_stack.reserve(open_cells);
+      flow_worklist.reserve(open_cells);
+    }
+
+    // The propagators are depth-first searches over the grid. They run on explicit stacks,
+    // reserved for every open cell at construction, and visit cells and draw random numbers in
+    // the same order as the recursive formulation.
+
+    // The flow search works in VFlowType throughout and compares against the capacities
+    // converted to it, so an edge fills up exactly whatever the other types are
+    struct FlowFrame {
+      int x, y;
+      VFlowType lim, ret;
+      // direction being tried
+      size_t dir;
+    };
+
+    struct StopFrame {
+      int x, y;
+      // next direction to look at
+      size_t dir;
+    };
+
+    struct MoveFrame {
+      int x, y;
+      // direction chosen last
+      size_t dir;
+      // directions drawn so far, the index of the next MoveDirection draw
+      uint32_t draws;
+    };
+
+    struct MoveRecord {
+      int x, y;
+      size_t dir;
+    };
+
+    // Bookkeeping of the move and stop searches. The serial scope may write anywhere and logs
+    // swaps directly; a band scope only writes rows [x0, x1) and journals what it does, so a
+    // search that would leave the band can be undone.
+    struct MoveScope {
+      size_t x0 = 0, x1 = 0;
+      bool banded = false;
+      // set when a search of a band scope tried to write outside of it
+      bool aborted = false;
+      // a start cell decided to move and its search completed
+      bool prop = false;
+      std::vector<MoveFrame> move_stack;
+      std::vector<StopFrame> stop_stack;
+      // last_use writes of the current start cell with the values they replaced
+      std::vector<pair<int *, int> > undo;
+      // swaps of the committed searches of this tick, then those of the current start cell
+      std::vector<MoveRecord> swaps;
+      // start cells left for the serial pass
+      std::vector<pair<int, int> > deferred;
+      // cells just outside the band a stop search reached, where the owner of those rows
+      // continues it
+      std::vector<pair<int, int> > stop_seeds;
+      // counters of this tick, for the serial scope those of the whole phase once it is done
+      MoveStats stats;
+
+      bool owns(size_t x) const {
+        return !banded || (x0 <= x && x < x1);
       }
+    };
 
-      rnd.seed(1337);
+    // last_use[x][y] = value, unless a band scope may not write there: then the scope is
+    // aborted and the result is false
+    bool mark(MoveScope &scope, int x, int y, int value) {
+      if (scope.banded) {
+        if (!scope.owns(x)) {
+          scope.aborted = true;
+          return false;
+        }
+        scope.undo.push_back({&last_use[x][y], last_use[x][y]});
+      }
+      last_use[x][y] = value;
+      return true;
     }
 
-    tuple<PType, bool, pair<int, int> > propagate_flow(int x, int y, PType lim) {
+    tuple<VFlowType, bool, pair<int, int> > propagate_flow(int x, int y, VFlowType lim) {
+      // what the frame popped last returned to its caller
+      tuple<VFlowType, bool, pair<int, int> > result;
+      bool returned = false;
       last_use[x][y] = UT - 1;
-      PType ret = PType{0};
-      for (auto [dx, dy] : deltas) {
-        int nx = x + dx, ny = y + dy;
-        if (field[nx][ny] != '#' && last_use[nx][ny] < UT) {
-          auto cap = velocity.get(x, y, dx, dy);
-          auto flow = velocity_flow.get(x, y, dx, dy);
-          if (flow == cap) {
+      flow_stack.push_back({x, y, lim, VFlowType{0}, 0});
+      flow_work.visited++;
+      if constexpr (stats_enabled) {
+        flow_work.calls++;
+        flow_work.depth = max<size_t>(flow_work.depth, 1);
+      }
+      while (!flow_stack.empty()) {
+        FlowFrame &frame = flow_stack.back();
+        if (returned) {
+          auto [t, prop, end] = result;
+          frame.ret += t;
+          if (prop) {
+            add_flow(frame.x, frame.y, frame.dir, t);
+            last_use[frame.x][frame.y] = UT;
+            result = {t, end != pair(frame.x, frame.y), end};
+            flow_stack.pop_back();
             continue;
           }
-          auto vp = min(lim, cap - flow);
-          if (last_use[nx][ny] == UT - 1) {
-            velocity_flow.add(x, y, dx, dy, vp);
-            last_use[x][y] = UT;
-            return {vp, 1, {nx, ny}};
+          returned = false;
+          ++frame.dir;
+        }
+        FlowFrame child{-1, -1, VFlowType{0}, VFlowType{0}, 0};
+        for (; frame.dir < deltas.size(); ++frame.dir) {
+          auto [dx, dy] = deltas[frame.dir];
+          int nx = frame.x + dx, ny = frame.y + dy;
+          if (topology.open(frame.x, frame.y, frame.dir) && last_use[nx][ny] < UT) {
+            auto cap = capacity(frame.x, frame.y, frame.dir);
+            auto flow = velocity_flow.get(frame.x, frame.y, frame.dir);
+            if (flow == cap) {
+              continue;
+            }
+            auto vp = min(frame.lim, cap - flow);
+            if (last_use[nx][ny] == UT - 1) {
+              add_flow(frame.x, frame.y, frame.dir, vp);
+              result = {vp, 1, {nx, ny}};
+              returned = true;
+            } else {
+              last_use[nx][ny] = UT - 1;
+              child = {nx, ny, vp, VFlowType{0}, 0};
+              flow_work.visited++;
+            }
+            break;
           }
-          auto [t, prop, end] = propagate_flow(nx, ny, vp);
-          ret += t;
-          if (prop) {
-            velocity_flow.add(x, y, dx, dy, t);
-            last_use[x][y] = UT;
-            return {t, end != pair(x, y), end};
+        }
+        if (child.x >= 0) {
+          flow_stack.push_back(child);
+          if constexpr (stats_enabled) {
+            flow_work.depth = max(flow_work.depth, flow_stack.size());
           }
+          continue;
         }
+        if (!returned) {
+          result = {frame.ret, 0, {0, 0}};
+          returned = true;
+        }
+        last_use[frame.x][frame.y] = UT;
+        flow_stack.pop_back();
       }
-      last_use[x][y] = UT;
-      return {ret, 0, {0, 0}};
+      return result;
     }
 
-    void propagate_stop(int x, int y, bool force = false) {
-      if (!force) {
-        bool stop = true;
-        for (auto [dx, dy] : deltas) {
-          int nx = x + dx, ny = y + dy;
-          if (field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > VType(0)) {
-            stop = false;
-            break;
-          }
-        }
-        if (!stop) {
-          return;
+    void add_flow(int x, int y, size_t dir, VFlowType amount) {
+      if (velocity_flow.add(x, y, dir, amount) == capacity(x, y, dir)) {
+        flow_saturated = true;
+      }
+    }
+
+    VFlowType capacity(int x, int y, size_t dir) const {
+      return VFlowType(velocity.get(x, y, dir));
+    }
+
+    size_t cell_index(size_t x, size_t y) const {
+      return x * m + y;
+    }
+
+    bool has_capacity(int x, int y) const {
+      for (size_t i = 0; i < deltas.size(); ++i) {
+        if (topology.open(x, y, i) && velocity_flow.get(x, y, i) != capacity(x, y, i)) {
+          return true;
         }
       }
-      last_use[x][y] = UT;
-      for (auto [dx, dy] : deltas) {
+      return false;
+    }
+
+    bool stoppable(int x, int y) {
+      for (size_t i = 0; i < deltas.size(); ++i) {
+        auto [dx, dy] = deltas[i];
         int nx = x + dx, ny = y + dy;
-        if (field[nx][ny] == '#' || last_use[nx][ny] == UT || velocity.get(x, y, dx, dy) > VType(0)) {
-          continue;
+        if (topology.open(x, y, i) && last_use[nx][ny] < UT - 1 && velocity.get(x, y, i) > VType(0)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void propagate_stop(MoveScope &scope, int x, int y, bool force = false) {
+      if (!scope.owns(x)) {
+        scope.stop_seeds.push_back({x, y});
+        return;
+      }
+      if (!force && !stoppable(x, y)) {
+        return;
+      }
+      mark(scope, x, y, UT);
+      auto &stack = scope.stop_stack;
+      stack.push_back({x, y, 0});
+      while (!stack.empty()) {
+        StopFrame &frame = stack.back();
+        bool descended = false;
+        while (frame.dir < deltas.size() && !descended) {
+          size_t i = frame.dir++;
+          auto [dx, dy] = deltas[i];
+          int nx = frame.x + dx, ny = frame.y + dy;
+          if (!topology.open(frame.x, frame.y, i) || last_use[nx][ny] == UT || velocity.get(frame.x, frame.y, i) > VType(0)) {
+            continue;
+          }
+          if (!scope.owns(nx)) {
+            scope.stop_seeds.push_back({nx, ny});
+            continue;
+          }
+          if (stoppable(nx, ny)) {
+            mark(scope, nx, ny, UT);
+            stack.push_back({nx, ny, 0});
+            descended = true;
+          }
+        }
+        if (!descended) {
+          stack.pop_back();
         }
-        propagate_stop(nx, ny);
       }
     }
 
     VType move_prob(int x, int y) {
       VType sum = VType(0);
-      for (auto [dx, dy] : deltas) {
+      for (size_t i = 0; i < deltas.size(); ++i) {
+        auto [dx, dy] = deltas[i];
         int nx = x + dx, ny = y + dy;
-        if (field[nx][ny] == '#' || last_use[nx][ny] == UT) {
+        if (!topology.open(x, y, i) || last_use[nx][ny] == UT) {
           continue;
         }
-        auto v = velocity.get(x, y, dx, dy);
+        auto v = velocity.get(x, y, i);
         if (v < VType(0)) {
           continue;
         }
@@ -122,198 +345,910 @@ class Simulator {
     void swap_with(ParticleParams &pp, int x, int y) {
       swap(field[x][y], pp.type);
       swap(p[x][y], pp.cur_p);
-      swap(velocity.v[x][y], pp.v);
+      velocity.v.swap_cell(x, y, pp.v);
     }
 
-    bool propagate_move(int x, int y, bool is_first) {
-      last_use[x][y] = UT - is_first;
+    template<typename Random>
+    bool propagate_move(Random &random, MoveScope &scope, int x, int y, bool is_first) {
+      if (!mark(scope, x, y, UT - is_first)) {
+        return false;
+      }
+      auto &stack = scope.move_stack;
+      stack.push_back({x, y, 0, 0});
+      count_move_call(scope);
+      // outcome of the frame that finished last, false also while a frame is still choosing
       bool ret = false;
-      int nx = -1, ny = -1;
-      do {
-        std::array<VType, deltas.size()> tres;
-        VType sum(0);
-        for (size_t i = 0; i < deltas.size(); ++i) {
-          auto [dx, dy] = deltas[i];
-          int nx = x + dx, ny = y + dy;
-          if (field[nx][ny] == '#' || last_use[nx][ny] == UT) {
-            tres[i] = sum;
-            continue;
-          }
-          auto v = velocity.get(x, y, dx, dy);
-          if (v < VType(0)) {
-            tres[i] = sum;
-            continue;
+      while (!stack.empty()) {
+        MoveFrame &frame = stack.back();
+        if (!ret) {
+          int nx, ny;
+          if (choose_move(random, frame, nx, ny)) {
+            if (last_use[nx][ny] != UT - 1) {
+              if (!mark(scope, nx, ny, UT)) {
+                break;
+              }
+              stack.push_back({nx, ny, 0, 0});
+              count_move_call(scope);
+              continue;
+            }
+            ret = true;
           }
-          sum += v;
-          tres[i] = sum;
         }
-
-        if (sum == VType(0)) {
+        finish_move(scope, frame, ret, stack.size() > 1 || !is_first);
+        if (scope.aborted) {
           break;
         }
+        stack.pop_back();
+      }
+      stack.clear();
+      return ret;
+    }
+
+    void count_move_call(MoveScope &scope) {
+      if constexpr (stats_enabled) {
+        scope.stats.calls++;
+        scope.stats.depth = max(scope.stats.depth, scope.move_stack.size());
+      }
+    }
+
+    // Draws the direction the particle at the frame's cell moves in, false if it cannot move
+    template<typename Random>
+    bool choose_move(Random &random, MoveFrame &frame, int &nx, int &ny) {
+      int x = frame.x, y = frame.y;
+      std::array<VType, deltas.size()> tres;
+      VType sum(0);
+      for (size_t i = 0; i < deltas.size(); ++i) {
+        auto [dx, dy] = deltas[i];
+        int nx = x + dx, ny = y + dy;
+        if (!topology.open(x, y, i) || last_use[nx][ny] == UT) {
+          tres[i] = sum;
+          continue;
+        }
+        auto v = velocity.get(x, y, i);
+        if (v < VType(0)) {
+          tres[i] = sum;
+          continue;
+        }
+        sum += v;
+        tres[i] = sum;
+      }
 
-        auto p = PType(rnd) * sum;
-        size_t d = std::ranges::upper_bound(tres, p) - tres.begin();
+      if (sum == VType(0)) {
+        return false;
+      }
+
+      auto p = random01<VType>(random.bits(tick, cell_index(x, y), MoveDirection, frame.draws++)) * sum;
+      size_t d = std::ranges::upper_bound(tres, p) - tres.begin();
 
-        auto [dx, dy] = deltas[d];
-        nx = x + dx;
-        ny = y + dy;
-        assert(velocity.get(x, y, dx, dy) > VType(0) && field[nx][ny] != '#' && last_use[nx][ny] < UT);
+      auto [dx, dy] = deltas[d];
+      nx = x + dx;
+      ny = y + dy;
+      frame.dir = d;
+      assert(velocity.get(x, y, d) > VType(0) && topology.open(x, y, d) && last_use[nx][ny] < UT);
+      return true;
+    }
 
-        ret = (last_use[nx][ny] == UT - 1 || propagate_move(nx, ny, false));
-      } while (!ret);
-      last_use[x][y] = UT;
+    void finish_move(MoveScope &scope, const MoveFrame &frame, bool ret, bool swap) {
+      auto [x, y, dir, _] = frame;
+      mark(scope, x, y, UT);
       for (size_t i = 0; i < deltas.size(); ++i) {
         auto [dx, dy] = deltas[i];
         int nx = x + dx, ny = y + dy;
-        if (field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) < VType(0)) {
-          propagate_stop(nx, ny);
+        if (topology.open(x, y, i) && last_use[nx][ny] < UT - 1 && velocity.get(x, y, i) < VType(0)) {
+          propagate_stop(scope, nx, ny);
+          if (scope.aborted) {
+            return;
+          }
         }
       }
-      if (ret) {
-        if (!is_first) {
-          ParticleParams pp{};
-          swap_with(pp, x, y);
-          swap_with(pp, nx, ny);
-          swap_with(pp, x, y);
+      if (ret && swap) {
+        exchange(x, y, dir);
+        if (scope.banded) {
+          scope.swaps.push_back({x, y, dir});
+          return;
+        }
+        if constexpr (stats_enabled) {
+          scope.stats.moved++;
+        }
+        if (move_log != nullptr) {
+          move_log->swap(x, y, dir);
         }
       }
-      return ret;
     }
 
-    void execute() {
-      // Dir nums for each cell
+    // Swaps the particles of (x, y) and its neighbour in direction dir, its own inverse
+    void exchange(int x, int y, size_t dir) {
+      auto [dx, dy] = deltas[dir];
+      ParticleParams pp{};
+      swap_with(pp, x, y);
+      swap_with(pp, x + dx, y + dy);
+      swap_with(pp, x, y);
+    }
+
+    // Last step of a tick for one cell that no search reached yet: draw whether its particle
+    // moves, then run the move or stop search from it
+    template<typename Random>
+    void start_move(Random &random, MoveScope &scope, int x, int y) {
+      bool moving = random01<VType>(random.bits(tick, cell_index(x, y), MoveStart, 0)) < VType(move_prob(x, y));
+      if (moving) {
+        propagate_move(random, scope, x, y, true);
+      } else {
+        propagate_stop(scope, x, y, true);
+      }
+      if (moving && !scope.aborted) {
+        scope.prop = true;
+      }
+    }
+
+    // Runs ticks until `until` of them are done in total, handing the field to `frames` after
+    // every tick, nullptr runs silently. Returns early, and from then on at once, when one of
+    // the stop criteria is met (see stop_reason).
+    void execute(size_t until = T, FrameWriter *frames = nullptr) {
+      while (tick < until && stop == StopReason::None) {
+        step(frames);
+      }
+    }
+
+    // Runs `count` more ticks or fewer if a stop criterion ends the run, returns how many ran
+    size_t step(size_t count) {
+      size_t first = tick;
+      while (tick - first < count && stop == StopReason::None) {
+        step();
+      }
+      return tick - first;
+    }
+
+    // Field as it was after a tick that moved something
+    struct Frame {
+      size_t tick;
+      const FieldGrid &field;
+    };
+
+    // Steps until `until` ticks are done in total or the run stops, yielding after every tick
+    // that moved something. The frame refers to the live field, which the next step changes;
+    // the Simulator must outlive the generator.
+    Generator<Frame> moved_frames(size_t until = T) {
+      while (tick < until && stop == StopReason::None) {
+        size_t current = tick;
+        if (step()) {
+          co_yield Frame{current, field};
+        }
+      }
+    }
+
+    // Runs a single tick, returns whether any particle moved. Does nothing once the run has
+    // stopped (see stop_reason).
+    bool step(FrameWriter *frames = nullptr) {
+      if (stop != StopReason::None) {
+        return false;
+      }
+      PType total_delta_p{};
+
+      // add gravitational force to each velocity
+      enter_phase(Phase::Gravity);
+      for_rows([this](size_t x0, size_t x1) { apply_gravity(x0, x1); });
+
+      // p and old_p are double buffered: every passable cell of the new p starts from its
+      // old value, walls keep p = 0 in both buffers
+      enter_phase(Phase::Pressure);
+      swap(p, old_p);
+      for_rows([this](size_t x0, size_t x1) { apply_pressure(x0, x1); });
+      sum_rows(total_delta_p);
+
+      // Propagate flow. A cell whose edges are all saturated adds nothing to any path and
+      // stays saturated for the rest of the phase, so rounds only start from the cells that
+      // still have capacity left; the others would only get their last_use mark
+      enter_phase(Phase::Flow);
+      velocity_flow.clear();
+      flow_worklist.clear();
       for (size_t x = 0; x < n; ++x) {
-        for (size_t y = 0; y < m; ++y) {
-          if (field[x][y] == '#')
-            continue;
-          for (auto [dx, dy] : deltas) {
-            dirs[x][y] += (field[x + dx][y + dy] != '#');
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            if (has_capacity(x, y)) {
+              flow_worklist.push_back({int(x), int(y)});
+            }
           }
         }
       }
+      flow_work = {0, flow_worklist.size(), 0, 0, 0};
+      bool prop = false;
+      do {
+        UT += 2;
+        prop = false;
+        flow_work.rounds++;
+        flow_saturated = false;
+        for (auto [x, y] : flow_worklist) {
+          if (last_use[x][y] != UT) {
+            auto [t, local_prop, _] = propagate_flow(x, y, VFlowType(1));
+            if (t > VFlowType(0)) {
+              prop = true;
+            }
+          }
+        }
+        // only an edge that just filled up can take a cell off the list
+        if (flow_saturated) {
+          std::erase_if(flow_worklist, [this](pair<int, int> cell) { return !has_capacity(cell.first, cell.second); });
+        }
+      } while (prop);
 
-      // each tick
-      for (size_t i = 0; i < T; ++i) {
-        PType total_delta_p{};
+      // Recalculate p with kinetic energy
+      enter_phase(Phase::Kinetic);
+      if (pool == nullptr) {
+        apply_kinetic(0, n);
+      } else {
+        pool->parallel_for(n, [this](size_t x0, size_t x1) { scatter_kinetic(x0, x1); });
+        pool->parallel_for(n, [this](size_t x0, size_t x1) { gather_kinetic(x0, x1); });
+      }
+      sum_rows(total_delta_p);
 
-        // add gravitational force to each velocity
-        for (size_t x = 0; x < n; ++x) {
-          for (size_t y = 0; y < m; ++y) {
-            if (field[x][y] == '#')
+      enter_phase(Phase::Move);
+      UT += 2;
+      prop = std::visit([this](auto &random) { return move_particles(random); }, rng);
+
+      enter_phase(Phase::Output);
+      if (frames != nullptr) {
+        frames->on_tick(tick, prop, field);
+      }
+      if (move_log != nullptr) {
+        move_log->end_tick(tick, prop);
+      }
+      if (state_trace != nullptr) {
+        state_trace->record(tick, state_hash());
+        if (state_trace->wants_dump(tick)) {
+          dump_state(state_trace->dump_file(), tick + 1);
+        }
+      }
+      if constexpr (stats_enabled) {
+        if (phase_stats != nullptr) {
+          phase_stats->end_tick(tick, flow_work, serial_scope.stats);
+        }
+      }
+      check_stop(prop, total_delta_p);
+      ++tick;
+      return prop;
+    }
+
+    template<typename Random>
+    bool move_particles(Random &random) {
+      serial_scope.stats = {};
+      if constexpr (Random::counter_based) {
+        if (!bands.empty()) {
+          return move_particles_banded(random);
+        }
+      }
+      serial_scope.prop = false;
+      for (size_t x = 0; x < n; ++x) {
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            if (last_use[x][y] != UT) {
+              start_move(random, serial_scope, x, y);
+            }
+          }
+        }
+      }
+      return serial_scope.prop;
+    }
+
+    // Parallel move phase: the rows are cut into bands of move_band_rows, and even then odd
+    // bands run concurrently. A search reads at most two rows past its band, which belong to
+    // the idle neighbour bands, and only writes inside its own band:
+    //  - a stop search stops at the band edge and leaves the cells beyond as seeds, the odd
+    //    bands continue the seeds of their even neighbours before their own cells, the serial
+    //    pass those of the odd bands;
+    //  - a move search that needs to go further is rolled back and its start cell is retried
+    //    in the serial pass once both colors are done.
+    // The outcome depends on the seed only, not on the number of threads.
+    template<typename Random>
+    bool move_particles_banded(Random &random) {
+      bool prop = false;
+      for (size_t color = 0; color < 2; color++) {
+        size_t count = (bands.size() + 1 - color) / 2;
+        auto run = [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            move_band(random, 2 * i + color);
+          }
+        };
+        if (pool == nullptr) {
+          run(0, count);
+        } else {
+          pool->parallel_for(count, run);
+        }
+        // bands of one color moved disjoint cells, logging them band by band is a valid order
+        for (size_t i = color; i < bands.size(); i += 2) {
+          prop |= bands[i].prop;
+          if (move_log != nullptr) {
+            for (auto [x, y, dir] : bands[i].swaps) {
+              move_log->swap(x, y, dir);
+            }
+          }
+        }
+      }
+      serial_scope.prop = false;
+      for (size_t i = 1; i < bands.size(); i += 2) {
+        for (auto [x, y] : bands[i].stop_seeds) {
+          if (last_use[x][y] != UT) {
+            propagate_stop(serial_scope, x, y);
+          }
+        }
+      }
+      for (auto &band : bands) {
+        for (auto [x, y] : band.deferred) {
+          if (last_use[x][y] != UT) {
+            start_move(random, serial_scope, x, y);
+          }
+        }
+      }
+      if constexpr (stats_enabled) {
+        for (const auto &band : bands) {
+          serial_scope.stats.calls += band.stats.calls;
+          serial_scope.stats.depth = max(serial_scope.stats.depth, band.stats.depth);
+          serial_scope.stats.moved += band.swaps.size();
+        }
+      }
+      return prop || serial_scope.prop;
+    }
+
+    template<typename Random>
+    void move_band(Random &random, size_t index) {
+      MoveScope &band = bands[index];
+      band.prop = false;
+      band.stats = {};
+      band.swaps.clear();
+      band.deferred.clear();
+      band.stop_seeds.clear();
+      band.undo.clear();
+      if (index % 2 == 1) {
+        for (size_t neighbour : {index - 1, index + 1}) {
+          if (neighbour >= bands.size()) {
+            continue;
+          }
+          for (auto [x, y] : bands[neighbour].stop_seeds) {
+            if (band.owns(x) && last_use[x][y] != UT) {
+              propagate_stop(band, x, y);
+            }
+          }
+        }
+      }
+      for (size_t x = band.x0; x < band.x1; ++x) {
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            if (last_use[x][y] == UT) {
               continue;
-            if (field[x + 1][y] != '#')
-              velocity.add(x, y, 1, 0, g);
+            }
+            size_t committed = band.swaps.size(), seeds = band.stop_seeds.size();
+            band.undo.clear();
+            start_move(random, band, x, y);
+            if (band.aborted) {
+              for (size_t i = band.swaps.size(); i-- > committed;) {
+                auto [sx, sy, dir] = band.swaps[i];
+                exchange(sx, sy, dir);
+              }
+              band.swaps.resize(committed);
+              band.stop_seeds.resize(seeds);
+              for (size_t i = band.undo.size(); i-- > 0;) {
+                *band.undo[i].first = band.undo[i].second;
+              }
+              band.aborted = false;
+              band.deferred.push_back({int(x), int(y)});
+            }
           }
         }
+      }
+    }
+
+    // Runs the move phase in bands (see move_particles_banded) when the random policy is
+    // counter-based, otherwise the setting has no effect
+    void set_parallel_move(bool enabled) {
+      bands.clear();
+      if (!enabled) {
+        return;
+      }
+      for (size_t x0 = 0; x0 < size_t(n); x0 += move_band_rows) {
+        MoveScope &band = bands.emplace_back();
+        band.x0 = x0;
+        band.x1 = std::min<size_t>(n, x0 + move_band_rows);
+        band.banded = true;
+        size_t open_cells = 0;
+        for (size_t x = band.x0; x < band.x1; ++x) {
+          for (auto [y0, y1] : topology.open_runs(x)) {
+            open_cells += y1 - y0;
+          }
+        }
+        // a start cell marks each cell at most twice, every cell moves at most once a tick
+        band.move_stack.reserve(open_cells);
+        band.stop_stack.reserve(open_cells);
+        band.undo.reserve(2 * open_cells);
+        band.swaps.reserve(open_cells);
+        band.deferred.reserve(open_cells);
+        // a cell next to the band is left as a seed at most twice, by the stop search and by
+        // the finished move of its neighbour inside
+        band.stop_seeds.reserve(4 * m);
+      }
+    }
+
+    // Replaces the random number policy of the move phase, legacy mt19937 seeded with 1337
+    // by default
+    void set_rng(Rng generator) {
+      rng = std::move(generator);
+    }
+
+    // Replaces g and the densities and damping factors the scene came with, for sweeps over them
+    void set_constants(double gravity, const std::array<double, 256> &densities,
+                       const std::array<double, 256> &dampings = default_damping()) {
+      g = PType(gravity);
+      for (size_t i = 0; i < densities.size(); i++) {
+        rho[i] = PType(densities[i]);
+        damping[i] = PType(dampings[i]);
+      }
+      build_materials();
+    }
+
+    // Records every swap from now on, starting the log from the current field
+    void set_move_log(MoveLogWriter *log) {
+      move_log = log;
+      if (move_log != nullptr) {
+        move_log->begin(n, m, tick, field);
+      }
+    }
+
+    // Splits the gravity, pressure and kinetic phases by rows over `pool`, nullptr runs them
+    // on the calling thread. The results are the same for any number of threads.
+    void set_thread_pool(ThreadPool *threads) {
+      pool = threads;
+      if (pool != nullptr && kinetic_force.rows() != size_t(n)) {
+        kinetic_force = Grid<KineticForce>(n, m);
+      }
+    }
+
+    // Stops execute() once `ticks` consecutive ticks moved nothing and changed the total
+    // pressure by at most `delta_p` each. 0 ticks turns the check off. The count of quiet
+    // ticks is not part of a checkpoint, a resumed run starts it from zero.
+    void set_steady_state(size_t ticks, double delta_p) {
+      steady_ticks = ticks;
+      steady_delta_p = PType(delta_p);
+    }
+
+    // Stops execute() after the first tick that ends past `time`
+    void set_deadline(chrono::steady_clock::time_point time) {
+      deadline = time;
+    }
+
+    StopReason stop_reason() const {
+      return stop;
+    }
+
+    // total_delta_p of the last tick and how many ticks in a row were quiet up to it
+    PType last_delta_p() const {
+      return delta_p;
+    }
+
+    size_t quiet_ticks() const {
+      return quiet;
+    }
+
+    // Records the state_hash() of every tick from now on, nullptr stops it
+    void set_state_trace(StateTrace *trace) {
+      state_trace = trace;
+    }
+
+    // Fingerprint of field, p, velocity and the random generator, see state_hash.hpp
+    StateHash state_hash() const {
+      std::ostringstream rng_state;
+      std::visit([&](const auto &policy) { rng_state << policy; }, rng);
+      return hash_state(n, m, [this](size_t x, size_t y) { return field[x][y]; },
+                        [this](size_t x, size_t y) { return p[x][y]; },
+                        [this](size_t x, size_t y, size_t i) { return velocity.get(x, y, i); }, rng_state.str());
+    }
+
+    // Writes the canonical state of write_state_dump
+    void dump_state(const std::string &path) const {
+      dump_state(path, tick);
+    }
+
+    // Times the phases of every tick into `stats` from now on, nullptr stops it. Does nothing
+    // in a build with FLUID_STATS=0.
+    void set_phase_stats(PhaseStats *stats) {
+      phase_stats = stats;
+    }
+
+    const FlowStats &flow_stats() const {
+      return flow_work;
+    }
+
+    const MoveStats &move_stats() const {
+      return serial_scope.stats;
+    }
+
+    size_t ticks_done() const {
+      return tick;
+    }
+
+    size_t rows() const {
+      return n;
+    }
+
+    size_t cols() const {
+      return m;
+    }
+
+    // Read-only views of the state between steps, indexed [x][y] and get(x, y, dir)
+    const FieldGrid &cells() const {
+      return field;
+    }
 
-        old_p = p;
+    const PressureGrid &pressure() const {
+      return p;
+    }
+
+    const VelocityField &velocities() const {
+      return velocity;
+    }
+
+    // Full state needed to continue bit-identically: field, p, velocity, last_use, UT, the
+    // random generator and the tick counter, plus g, rho and damping. Topology is rebuilt from the
+    // field, velocity_flow and old_p are recomputed every tick.
+    void save_checkpoint(const std::string &path) const {
+      CheckpointWriter writer(path);
+      auto &header = writer.header;
+      header.n = n;
+      header.m = m;
+      header.ut = UT;
+      header.tick = tick;
+      set_type_name(header.p_type, TypeName<PType>::get());
+      set_type_name(header.v_type, TypeName<VType>::get());
+      set_type_name(header.v_flow_type, TypeName<VFlowType>::get());
+
+      writer.section(CheckpointSection::Constants, sizeof(PType) + sizeof(rho) + sizeof(damping), [&](std::ostream &out) {
+        out.write(reinterpret_cast<const char *>(&g), sizeof(PType));
+        out.write(reinterpret_cast<const char *>(rho), sizeof(rho));
+        out.write(reinterpret_cast<const char *>(damping), sizeof(damping));
+      });
+      write_rows(writer, CheckpointSection::Field, field);
+      write_rows(writer, CheckpointSection::Pressure, p);
+      writer.section(CheckpointSection::Velocity, sizeof(VType) * n * m * deltas.size(), [&](std::ostream &out) {
         for (size_t x = 0; x < n; ++x) {
           for (size_t y = 0; y < m; ++y) {
-            if (field[x][y] == '#')
-              continue;
-            for (auto [dx, dy] : deltas) {
+            for (size_t i = 0; i < deltas.size(); ++i) {
+              VType v = velocity.get(x, y, i);
+              out.write(reinterpret_cast<const char *>(&v), sizeof(VType));
+            }
+          }
+        }
+      });
+      write_rows(writer, CheckpointSection::LastUse, last_use);
+      std::ostringstream random_state;
+      random_state << rng;
+      std::string state = random_state.str();
+      writer.raw(CheckpointSection::Random, state.data(), state.size());
+      writer.commit();
+    }
+
+    // Restores a checkpoint written by a Simulator with the same types and scene size
+    void load_checkpoint(const std::string &path) {
+      CheckpointReader reader(path);
+      auto &header = reader.header;
+      reader.check_type(header.p_type, TypeName<PType>::get(), "--p-type");
+      reader.check_type(header.v_type, TypeName<VType>::get(), "--v-type");
+      reader.check_type(header.v_flow_type, TypeName<VFlowType>::get(), "--v-flow-type");
+      if (header.n != static_cast<uint32_t>(n) || header.m != static_cast<uint32_t>(m)) {
+        throw std::runtime_error(path + " holds a " + std::to_string(header.n) + "x" + std::to_string(header.m) +
+                                 " scene");
+      }
+
+      auto constants = reader.section(CheckpointSection::Constants, sizeof(PType) + sizeof(rho) + sizeof(damping));
+      std::memcpy(&g, constants.data(), sizeof(PType));
+      std::memcpy(rho, constants.data() + sizeof(PType), sizeof(rho));
+      std::memcpy(damping, constants.data() + sizeof(PType) + sizeof(rho), sizeof(damping));
+      build_materials();
+      auto cells = reader.section(CheckpointSection::Field, n * m);
+      for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < m; ++y) {
+          if ((field[x][y] == '#') != (cells[x * m + y] == '#')) {
+            throw std::runtime_error(path + " has different walls than the scene");
+          }
+        }
+      }
+      read_rows(reader, CheckpointSection::Field, field);
+      read_rows(reader, CheckpointSection::Pressure, p);
+      auto velocities = reader.section(CheckpointSection::Velocity, sizeof(VType) * n * m * deltas.size());
+      const char *cursor = velocities.data();
+      for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < m; ++y) {
+          for (size_t i = 0; i < deltas.size(); ++i) {
+            std::memcpy(&velocity.get(x, y, i), cursor, sizeof(VType));
+            cursor += sizeof(VType);
+          }
+        }
+      }
+      read_rows(reader, CheckpointSection::LastUse, last_use);
+      std::istringstream random_state{std::string(reader.section(CheckpointSection::Random))};
+      random_state >> rng;
+      if (!random_state) {
+        throw std::runtime_error(path + ": damaged random generator state");
+      }
+      UT = header.ut;
+      tick = header.tick;
+    }
+
+  private:
+    // Kinetic contributions of one source cell, force[i] is meant for its neighbour in
+    // direction i (itself towards a wall), valid where bit i of mask is set
+    struct KineticForce {
+      array<PType, deltas.size()> force;
+      uint8_t mask;
+    };
+
+    // What the pressure and kinetic phases need of a cell's material, so they multiply
+    // instead of dividing
+    struct Material {
+      PType rho;
+      // 0 for characters without a density
+      PType inv_rho;
+      // rho * damping, what a velocity drop turns into pressure with
+      PType kinetic_rho;
+    };
+
+    void build_materials() {
+      for (size_t i = 0; i < materials.size(); i++) {
+        materials[i] = {rho[i], rho[i] == PType(0) ? PType(0) : PType(1) / rho[i], rho[i] * damping[i]};
+      }
+      inv_neighbours[0] = PType(0);
+      for (size_t count = 1; count < inv_neighbours.size(); count++) {
+        inv_neighbours[count] = PType(1) / PType(int(count));
+      }
+    }
+
+    const Material &material(size_t x, size_t y) const {
+      return materials[static_cast<unsigned char>(field[x][y])];
+    }
+
+    template<typename Fn>
+    void for_rows(Fn &&fn) {
+      if (pool == nullptr) {
+        fn(size_t{0}, size_t(n));
+      } else {
+        pool->parallel_for(n, fn);
+      }
+    }
+
+    // Adds the per-row partial sums of the last phase in row order, so the total does not
+    // depend on how rows were split between threads
+    void sum_rows(PType &total) const {
+      for (size_t x = 0; x < n; ++x) {
+        total += row_delta_p[x];
+      }
+    }
+
+    void apply_gravity(size_t x0, size_t x1) {
+      VType gravity(g);
+      for (size_t x = x0; x < x1; ++x) {
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          // SoA keeps the Down velocities of a row contiguous, one vector add covers a block of
+          // cells; AoS would use one lane in four
+          if constexpr (Layout.velocity == VelocityLayout::SoA) {
+            add_where(&velocity.template get<Down>(x, y0), topology.row(x) + y0, 1 << Down, gravity, y1 - y0);
+            continue;
+          }
+          for (size_t y = y0; y < y1; ++y) {
+            if (topology.open(x, y, Down))
+              velocity.template get<Down>(x, y) += gravity;
+          }
+        }
+      }
+    }
+
+    // Only the higher-pressure side of an edge touches its two velocities, so rows can run
+    // concurrently: every write is to the own cell or to an edge owned by it
+    void apply_pressure(size_t x0, size_t x1) {
+      for (size_t x = x0; x < x1; ++x) {
+        PType row_delta{};
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            p[x][y] = old_p[x][y];
+            for (size_t i = 0; i < deltas.size(); ++i) {
               // Add forces from p
+              auto [dx, dy] = deltas[i];
               int nx = x + dx, ny = y + dy;
-              if (field[nx][ny] != '#' && old_p[nx][ny] < old_p[x][y]) {
+              if (topology.open(x, y, i) && old_p[nx][ny] < old_p[x][y]) {
                 auto force = old_p[x][y] - old_p[nx][ny];
-                auto &contr = velocity.get(nx, ny, -dx, -dy);
-                if (contr * rho[(int) field[nx][ny]] >= force) {
-                  contr -= force / rho[(int) field[nx][ny]];
+                auto &contr = velocity.get(nx, ny, opposite[i]);
+                const auto &neighbour = material(nx, ny);
+                if (PType(contr) * neighbour.rho >= force) {
+                  contr -= VType(force * neighbour.inv_rho);
                   continue;
                 }
-                force -= contr * rho[(int) field[nx][ny]];
-                velocity.add(x, y, dx, dy, force / rho[field[x][y]]);
-                p[x][y] -= force / PType(dirs[x][y]);
-                total_delta_p -= force / PType(dirs[x][y]);
+                force -= PType(contr) * neighbour.rho;
+                velocity.add(x, y, i, VType(force * material(x, y).inv_rho));
+                auto share = force * inv_neighbours[topology.open_neighbours(x, y)];
+                p[x][y] -= share;
+                row_delta -= share;
               }
             }
           }
         }
+        row_delta_p[x] = row_delta;
+      }
+    }
 
-        // Propagate flow
-        velocity_flow = VectorField<VFlowType>(n, m);
-        bool prop = false;
-        do {
-          UT += 2;
-          prop = false;
-          for (size_t x = 0; x < n; ++x) {
-            for (size_t y = 0; y < m; ++y) {
-              if (field[x][y] != '#' && last_use[x][y] != UT) {
-                auto [t, local_prop, _] = propagate_flow(x, y, PType(1));
-                if (t > PType(0)) {
-                  prop = true;
-                }
+    PType kinetic_force_at(size_t x, size_t y, size_t i) {
+      auto old_v = velocity.get(x, y, i);
+      auto new_v = VType(velocity_flow.get(x, y, i));
+      // a VFlowType capacity may round above the velocity it came from
+      if constexpr (is_same_v<VType, VFlowType>) {
+        assert(new_v <= old_v);
+      } else {
+        new_v = min(new_v, old_v);
+      }
+      velocity.get(x, y, i) = new_v;
+      auto force = PType(old_v - new_v) * material(x, y).kinetic_rho;
+      if (!topology.open(x, y, i)) {
+        return force * inv_neighbours[topology.open_neighbours(x, y)];
+      }
+      auto [dx, dy] = deltas[i];
+      return force * inv_neighbours[topology.open_neighbours(x + dx, y + dy)];
+    }
+
+    void apply_kinetic(size_t x0, size_t x1) {
+      for (size_t x = x0; x < x1; ++x) {
+        PType row_delta{};
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            for (size_t i = 0; i < deltas.size(); ++i) {
+              if (velocity.get(x, y, i) > VType(0)) {
+                auto force = kinetic_force_at(x, y, i);
+                auto [dx, dy] = topology.open(x, y, i) ? deltas[i] : pair(0, 0);
+                p[x + dx][y + dy] += force;
+                row_delta += force;
               }
             }
           }
-        } while (prop);
+        }
+        row_delta_p[x] = row_delta;
+      }
+    }
 
-        // Recalculate p with kinetic energy
-        for (size_t x = 0; x < n; ++x) {
-          for (size_t y = 0; y < m; ++y) {
-            if (field[x][y] == '#')
-              continue;
-            for (auto [dx, dy] : deltas) {
-              auto old_v = velocity.get(x, y, dx, dy);
-              auto new_v = velocity_flow.get(x, y, dx, dy);
-              if (old_v > VType(0)) {
-                assert(new_v <= old_v);
-                velocity.get(x, y, dx, dy) = new_v;
-                auto force = (old_v - new_v) * rho[(int) field[x][y]];
-                if (field[x][y] == '.')
-                  force *= PType(0.8);
-                if (field[x + dx][y + dy] == '#') {
-                  p[x][y] += force / PType(dirs[x][y]);
-                  total_delta_p += force / PType(dirs[x][y]);
-                } else {
-                  p[x + dx][y + dy] += force / PType(dirs[x + dx][y + dy]);
-                  total_delta_p += force / PType(dirs[x + dx][y + dy]);
-                }
+    // Threaded kinetic phase, first half: every cell computes what it hands to its neighbours
+    void scatter_kinetic(size_t x0, size_t x1) {
+      for (size_t x = x0; x < x1; ++x) {
+        PType row_delta{};
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            auto &cell = kinetic_force[x][y];
+            cell.mask = 0;
+            for (size_t i = 0; i < deltas.size(); ++i) {
+              if (velocity.get(x, y, i) > VType(0)) {
+                cell.force[i] = kinetic_force_at(x, y, i);
+                cell.mask |= 1 << i;
+                row_delta += cell.force[i];
               }
             }
           }
         }
+        row_delta_p[x] = row_delta;
+      }
+    }
 
-        UT += 2;
-        prop = false;
-        for (size_t x = 0; x < n; ++x) {
-          for (size_t y = 0; y < m; ++y) {
-            if (field[x][y] != '#' && last_use[x][y] != UT) {
-              if (VType(rnd) < VType(move_prob(x, y))) {
-                prop = true;
-                propagate_move(x, y, true);
-              } else {
-                propagate_stop(x, y, true);
+    // Second half: every cell adds what it received in the order the single-threaded loop
+    // would, sources in row-major order
+    void gather_kinetic(size_t x0, size_t x1) {
+      for (size_t x = x0; x < x1; ++x) {
+        for (auto [y0, y1] : topology.open_runs(x)) {
+          for (size_t y = y0; y < y1; ++y) {
+            auto &target = p[x][y];
+            auto receive = [&](size_t from, size_t sx, size_t sy, size_t dir) {
+              if (topology.open(x, y, from) && (kinetic_force[sx][sy].mask >> dir & 1)) {
+                target += kinetic_force[sx][sy].force[dir];
+              }
+            };
+            receive(Up, x - 1, y, Down);
+            receive(Left, x, y - 1, Right);
+            const auto &own = kinetic_force[x][y];
+            for (size_t i = 0; i < deltas.size(); ++i) {
+              if (!topology.open(x, y, i) && (own.mask >> i & 1)) {
+                target += own.force[i];
               }
             }
+            receive(Right, x, y + 1, Left);
+            receive(Down, x + 1, y, Up);
           }
         }
+      }
+    }
 
-        if (prop) {
-          cout << "Tick " << i << ":\n";
-          for (size_t x = 0; x < n; ++x) {
-            cout << field[x] << "\n";
-          }
+    void enter_phase(Phase phase) {
+      if constexpr (stats_enabled) {
+        if (phase_stats != nullptr) {
+          phase_stats->enter(phase);
         }
       }
     }
 
-  private:
-    int n, m;
+    void check_stop(bool moved, PType total_delta_p) {
+      delta_p = total_delta_p;
+      PType magnitude = total_delta_p < PType(0) ? -total_delta_p : total_delta_p;
+      quiet = !moved && magnitude <= steady_delta_p ? quiet + 1 : 0;
+      if (steady_ticks != 0 && quiet >= steady_ticks) {
+        stop = StopReason::Steady;
+      } else if (deadline && chrono::steady_clock::now() >= *deadline) {
+        stop = StopReason::WallTime;
+      }
+    }
+
+    void dump_state(const std::string &path, size_t ticks) const {
+      write_state_dump(path, ticks, n, m, [this](size_t x, size_t y) { return field[x][y]; },
+                       [this](size_t x, size_t y) { return p[x][y]; },
+                       [this](size_t x, size_t y, size_t i) { return velocity.get(x, y, i); });
+    }
+
+    template<typename Layer>
+    void write_rows(CheckpointWriter &writer, CheckpointSection id, const Layer &layer) const {
+      using Type = std::remove_cvref_t<decltype(layer[0][0])>;
+      writer.section(id, sizeof(Type) * n * m, [&](std::ostream &out) {
+        for (size_t x = 0; x < n; ++x) {
+          out.write(reinterpret_cast<const char *>(layer[x]), static_cast<std::streamsize>(sizeof(Type) * m));
+        }
+      });
+    }
+
+    template<typename Layer>
+    void read_rows(const CheckpointReader &reader, CheckpointSection id, Layer &layer) {
+      using Type = std::remove_cvref_t<decltype(layer[0][0])>;
+      auto bytes = reader.section(id, sizeof(Type) * n * m);
+      for (size_t x = 0; x < n; ++x) {
+        std::memcpy(layer[x], bytes.data() + sizeof(Type) * m * x, sizeof(Type) * m);
+      }
+    }
 
-    FieldStorageType field;
-    VectorField<VType> velocity;
-    VectorField<VFlowType> velocity_flow;
+    size_t tick = 0;
+    MoveLogWriter *move_log = nullptr;
+    ThreadPool *pool = nullptr;
+    PhaseStats *phase_stats = nullptr;
+    StateTrace *state_trace = nullptr;
 
+    FieldGrid field;
+    VelocityField velocity;
+    VectorField<VFlowType, N, M, Layout> velocity_flow;
+
+    // per cell character, persisted in checkpoints; materials is derived from them
     PType rho[256];
+    PType damping[256];
+    std::array<Material, 256> materials;
+    // 1 / open_neighbours for every count a cell can have, 0 for none
+    std::array<PType, deltas.size() + 1> inv_neighbours;
 
-    std::vector<std::vector<PType> > p, old_p;
-    std::vector<std::vector<int> > last_use, dirs;
+    PressureGrid p, old_p;
+    Grid<int, N, M, Layout.padded> last_use;
+    std::shared_ptr<const TopologyType> shared_topology;
+    const TopologyType &topology;
 
     int UT = 0;
-    PType g = 0.1;
+    PType g;
+
+    Rng rng = LegacyRng(1337);
+
+    // per-row partial sums of total_delta_p and the kinetic scatter buffer for the pool
+    std::vector<PType> row_delta_p;
+    Grid<KineticForce> kinetic_force{0, 0};
+
+    // a search holds every cell at most once, so reserving one frame per open cell means the
+    // stacks never grow during a tick
+    std::vector<FlowFrame> flow_stack;
+    MoveScope serial_scope;
+    // bands of the parallel move phase, empty when it is off
+    static constexpr size_t move_band_rows = 16;
+    std::vector<MoveScope> bands;
+
+    // cells the flow rounds start from, in row-major order
+    std::vector<pair<int, int> > flow_worklist;
+    FlowStats flow_work;
+    bool flow_saturated = false;
 
-    std::mt19937 rnd;
+    // early stop criteria and what they track
+    size_t steady_ticks = 0;
+    PType steady_delta_p{};
+    optional<chrono::steady_clock::time_point> deadline;
+    PType delta_p{};
+    size_t quiet = 0;
+    StopReason stop = StopReason::None;
 };
 #endif // SIMULATOR_HPP
@@ -0,0 +1,194 @@
+#ifndef STATE_HASH_HPP
+#define STATE_HASH_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Per-tick fingerprints of the simulation state for checking that two engines, or two builds
+// of one engine, compute the same thing. Only standard headers are used, so the reference
+// fluid.cpp can include it as well.
+//
+// Every layer is hashed in a canonical order that does not depend on the grid layout: cells
+// row-major, a velocity cell as its four directions in deltas order, each value as its raw
+// bytes. FIXED(32,16) and the reference Fixed therefore hash alike, floating point types
+// hash their bit patterns. The random generator contributes its textual state.
+//
+// A trace has one line per tick, "tick field p velocity rng" with the hashes in hex. A state
+// dump is the full canonical state of one tick:
+//   header  magic "FLUIDSD\0", u32 n, u32 m, u32 p size, u32 velocity size, u64 ticks done
+//   cells   per cell: field char, p, velocity[4]
+
+class StateHasher {
+  public:
+    void add(const void *data, size_t size) {
+      auto bytes = static_cast<const unsigned char *>(data);
+      while (size > 0) {
+        size_t take = std::min(size, sizeof(pending) - filled);
+        std::memcpy(reinterpret_cast<unsigned char *>(&pending) + filled, bytes, take);
+        filled += take;
+        bytes += take;
+        size -= take;
+        if (filled == sizeof(pending)) {
+          mix(pending);
+          pending = 0;
+          filled = 0;
+        }
+      }
+    }
+
+    template<typename Type>
+    void add(const Type &value) {
+      add(&value, sizeof(value));
+    }
+
+    uint64_t finish() const {
+      uint64_t h = state;
+      if (filled != 0) {
+        h = std::rotl(h ^ pending * k1, 31) * k2;
+      }
+      h ^= total + filled;
+      h ^= h >> 33;
+      h *= 0xFF51AFD7ED558CCD;
+      h ^= h >> 33;
+      return h;
+    }
+
+  private:
+    static constexpr uint64_t k1 = 0x87C37B91114253D5, k2 = 0x4CF5AD432745937F;
+
+    void mix(uint64_t word) {
+      state = std::rotl(state ^ word * k1, 31) * k2 + 0x52DCE729;
+      total += sizeof(word);
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15;
+    uint64_t pending = 0;
+    size_t filled = 0;
+    uint64_t total = 0;
+};
+
+struct StateHash {
+  uint64_t field = 0;
+  uint64_t p = 0;
+  uint64_t velocity = 0;
+  uint64_t rng = 0;
+
+  bool operator==(const StateHash &) const = default;
+};
+
+// cell(x, y) returns the field char, pressure(x, y) a value and velocity(x, y, i) a value of
+// one numeric type per layer
+template<typename Cell, typename Pressure, typename Velocity>
+StateHash hash_state(size_t n, size_t m, Cell &&cell, Pressure &&pressure, Velocity &&velocity,
+                     const std::string &rng_state) {
+  StateHasher field, p, v, rng;
+  for (size_t x = 0; x < n; ++x) {
+    for (size_t y = 0; y < m; ++y) {
+      field.add(cell(x, y));
+      p.add(pressure(x, y));
+      for (size_t i = 0; i < 4; ++i) {
+        v.add(velocity(x, y, i));
+      }
+    }
+  }
+  rng.add(rng_state.data(), rng_state.size());
+  return {field.finish(), p.finish(), v.finish(), rng.finish()};
+}
+
+inline std::string format_state_hash(size_t tick, const StateHash &hash) {
+  char line[96];
+  std::snprintf(line, sizeof(line), "%zu %016llx %016llx %016llx %016llx\n", tick,
+                static_cast<unsigned long long>(hash.field), static_cast<unsigned long long>(hash.p),
+                static_cast<unsigned long long>(hash.velocity), static_cast<unsigned long long>(hash.rng));
+  return line;
+}
+
+// Where an engine sends its per-tick hashes, and optionally the full state of one tick
+class StateTrace {
+  public:
+    StateTrace(const std::string &path, std::string dump_path = "", size_t dump_tick = 0)
+      : dump_path(std::move(dump_path)), dump_tick(dump_tick), out(std::fopen(path.c_str(), "w")) {
+      if (out == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+      }
+      // a line per tick reaches the file even if the engine aborts later
+      std::setvbuf(out, nullptr, _IOLBF, 1 << 12);
+    }
+
+    StateTrace(const StateTrace &) = delete;
+    StateTrace &operator=(const StateTrace &) = delete;
+
+    ~StateTrace() {
+      std::fclose(out);
+    }
+
+    void record(size_t tick, const StateHash &hash) {
+      std::string line = format_state_hash(tick, hash);
+      std::fwrite(line.data(), 1, line.size(), out);
+    }
+
+    // Whether the state right after `tick` (counting from 0) should be dumped, see
+    // write_state_dump
+    bool wants_dump(size_t tick) const {
+      return !dump_path.empty() && tick == dump_tick;
+    }
+
+    const std::string &dump_file() const {
+      return dump_path;
+    }
+
+  private:
+    std::string dump_path;
+    size_t dump_tick;
+    FILE *out;
+};
+
+constexpr std::array<char, 8> state_dump_magic{'F', 'L', 'U', 'I', 'D', 'S', 'D', '\0'};
+
+struct StateDumpHeader {
+  std::array<char, 8> magic = state_dump_magic;
+  uint32_t n = 0;
+  uint32_t m = 0;
+  // bytes of one p and one velocity value
+  uint32_t p_size = 0;
+  uint32_t velocity_size = 0;
+  uint64_t ticks = 0;
+};
+
+template<typename Cell, typename Pressure, typename Velocity>
+void write_state_dump(const std::string &path, size_t ticks, size_t n, size_t m, Cell &&cell, Pressure &&pressure,
+                      Velocity &&velocity) {
+  StateDumpHeader header;
+  header.n = n;
+  header.m = m;
+  header.p_size = sizeof(pressure(0, 0));
+  header.velocity_size = sizeof(velocity(0, 0, 0));
+  header.ticks = ticks;
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (size_t x = 0; x < n; ++x) {
+    for (size_t y = 0; y < m; ++y) {
+      char c = cell(x, y);
+      auto value = pressure(x, y);
+      out.write(&c, 1);
+      out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      for (size_t i = 0; i < 4; ++i) {
+        auto component = velocity(x, y, i);
+        out.write(reinterpret_cast<const char *>(&component), sizeof(component));
+      }
+    }
+  }
+  if (!out) {
+    throw std::runtime_error("Failed to write " + path);
+  }
+}
+
+#endif // STATE_HASH_HPP
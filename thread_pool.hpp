@@ -0,0 +1,108 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads that run one data-parallel loop at a time. The calling thread
+// takes the first slice itself; dispatching a loop neither allocates nor creates threads.
+class ThreadPool {
+  public:
+    explicit ThreadPool(size_t threads) : count(std::max<size_t>(threads, 1)) {
+      workers.reserve(count - 1);
+      for (size_t i = 1; i < count; i++) {
+        workers.emplace_back([this, i] { worker_loop(i); });
+      }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+      {
+        std::lock_guard lock(mutex);
+        stopping = true;
+      }
+      start_cv.notify_all();
+      for (auto &worker : workers) {
+        worker.join();
+      }
+    }
+
+    size_t size() const {
+      return count;
+    }
+
+    // Calls fn(begin, end) on contiguous slices of [0, items), one per thread, and returns
+    // once all of them are done. Slice boundaries depend only on items and size().
+    template<typename Fn>
+    void parallel_for(size_t items, Fn &&fn) {
+      if (count == 1 || items < 2) {
+        fn(size_t{0}, items);
+        return;
+      }
+      using Function = std::remove_reference_t<Fn>;
+      {
+        std::lock_guard lock(mutex);
+        task = [](void *context, size_t begin, size_t end) {
+          (*static_cast<Function *>(context))(begin, end);
+        };
+        context = const_cast<void *>(static_cast<const void *>(std::addressof(fn)));
+        total = items;
+        pending = count - 1;
+        ++generation;
+      }
+      start_cv.notify_all();
+      run_slice(0);
+      std::unique_lock lock(mutex);
+      done_cv.wait(lock, [this] { return pending == 0; });
+    }
+
+  private:
+    void run_slice(size_t index) {
+      size_t begin = total * index / count, end = total * (index + 1) / count;
+      if (begin < end) {
+        task(context, begin, end);
+      }
+    }
+
+    void worker_loop(size_t index) {
+      size_t seen = 0;
+      while (true) {
+        {
+          std::unique_lock lock(mutex);
+          start_cv.wait(lock, [&] { return stopping || generation != seen; });
+          if (stopping) {
+            return;
+          }
+          seen = generation;
+        }
+        run_slice(index);
+        std::lock_guard lock(mutex);
+        if (--pending == 0) {
+          done_cv.notify_one();
+        }
+      }
+    }
+
+    size_t count;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    bool stopping = false;
+    size_t generation = 0;
+    size_t pending = 0;
+
+    void (*task)(void *, size_t, size_t) = nullptr;
+    void *context = nullptr;
+    size_t total = 0;
+};
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,107 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "fixed.hpp"
+#include "grid.hpp"
+
+// Wall layout of a scene. Walls never move during a run, so this is built once and every
+// "is it '#'" test reads one byte per cell:
+//   bits 0-3  neighbour deltas[i] is passable
+//   bits 4-6  number of passable neighbours
+//   bit 7     the cell itself is passable
+// plus the passable cells of every row as runs of consecutive columns, so loops over the
+// open cells skip walls a run at a time
+template<size_t N = 0, size_t M = 0, bool Padded = false>
+class Topology {
+  public:
+    static constexpr uint8_t neighbours_mask = 0x0f;
+    static constexpr int count_shift = 4;
+    static constexpr uint8_t open_bit = 0x80;
+
+    // Columns [begin, end) of a row are all passable
+    struct OpenRun {
+      uint32_t begin, end;
+    };
+
+    template<typename Field>
+    Topology(const Field &field, size_t n, size_t m) : cells(n, m) {
+      auto passable = [&](long x, long y) {
+        return x >= 0 && y >= 0 && x < static_cast<long>(n) && y < static_cast<long>(m) && field[x][y] != '#';
+      };
+      for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < m; ++y) {
+          uint8_t bits = 0;
+          for (size_t i = 0; i < deltas.size(); ++i) {
+            auto [dx, dy] = deltas[i];
+            bits |= passable(x + dx, y + dy) << i;
+          }
+          bits |= std::popcount(bits) << count_shift;
+          if (passable(x, y)) {
+            bits |= open_bit;
+          }
+          cells[x][y] = bits;
+        }
+      }
+      row_runs.reserve(n + 1);
+      for (size_t x = 0; x < n; ++x) {
+        row_runs.push_back(runs.size());
+        for (size_t y = 0; y < m; ++y) {
+          if (!open(x, y)) {
+            continue;
+          }
+          if (runs.size() > row_runs.back() && runs.back().end == y) {
+            runs.back().end++;
+          } else {
+            runs.push_back({static_cast<uint32_t>(y), static_cast<uint32_t>(y + 1)});
+          }
+          count++;
+        }
+      }
+      row_runs.push_back(runs.size());
+    }
+
+    bool open(size_t x, size_t y) const {
+      return cells[x][y] & open_bit;
+    }
+
+    // Neighbour of (x, y) in direction dir is passable
+    bool open(size_t x, size_t y, size_t dir) const {
+      return cells[x][y] >> dir & 1;
+    }
+
+    uint8_t neighbours(size_t x, size_t y) const {
+      return cells[x][y] & neighbours_mask;
+    }
+
+    // Passable neighbours of a passable cell, the reference "dirs"
+    int open_neighbours(size_t x, size_t y) const {
+      return (cells[x][y] & ~open_bit) >> count_shift;
+    }
+
+    // Topology bytes of row x, for kernels that test bits of a whole row
+    const uint8_t *row(size_t x) const {
+      return cells[x];
+    }
+
+    // Passable cells of row x, left to right
+    std::span<const OpenRun> open_runs(size_t x) const {
+      return {runs.data() + row_runs[x], runs.data() + row_runs[x + 1]};
+    }
+
+    size_t open_cells() const {
+      return count;
+    }
+
+  private:
+    Grid<uint8_t, N, M, Padded> cells;
+    std::vector<OpenRun> runs;
+    // runs of row x are runs[row_runs[x]] up to runs[row_runs[x + 1]]
+    std::vector<size_t> row_runs;
+    size_t count = 0;
+};
+
+#endif // TOPOLOGY_HPP
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "mapped_file.hpp"
+#include "state_hash.hpp"
+
+// Finds where two runs stop agreeing, from the traces and state dumps of state_hash.hpp.
+//
+//   trace_diff <a.trace> <b.trace>     first tick whose hashes differ, and in which layers
+//   trace_diff <a.dump> <b.dump>       first cell whose state differs
+//   trace_diff --a="command" --b="command" [--dir=path]
+//     runs both commands side by side with --trace appended, then runs them again up to the
+//     first diverging tick with --dump-state and compares the dumps. The commands are engines
+//     that accept --trace, --dump-state, --dump-tick and --ticks: task2, task3 or original.
+//
+// Exits with 0 when the runs agree, 2 when they diverge and 1 on errors.
+
+struct TraceLine {
+  size_t tick;
+  StateHash hash;
+};
+
+static std::vector<TraceLine> read_trace(const std::string &path) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  std::vector<TraceLine> lines;
+  TraceLine line{};
+  while (in >> std::dec >> line.tick >> std::hex >> line.hash.field >> line.hash.p >> line.hash.velocity >>
+         line.hash.rng) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// Returns the first diverging tick, or -1 if the common prefix agrees
+static long compare_traces(const std::string &a_path, const std::string &b_path) {
+  auto a = read_trace(a_path), b = read_trace(b_path);
+  size_t common = std::min(a.size(), b.size());
+  for (size_t i = 0; i < common; i++) {
+    if (a[i].tick != b[i].tick || a[i].hash != b[i].hash) {
+      std::cout << "first divergence at tick " << a[i].tick << " in";
+      const char *separator = " ";
+      for (auto [name, differs] : {
+             std::pair{"field", a[i].hash.field != b[i].hash.field}, std::pair{"p", a[i].hash.p != b[i].hash.p},
+             std::pair{"velocity", a[i].hash.velocity != b[i].hash.velocity},
+             std::pair{"rng", a[i].hash.rng != b[i].hash.rng}
+           }) {
+        if (differs) {
+          std::cout << separator << name;
+          separator = ", ";
+        }
+      }
+      std::cout << "\n";
+      return static_cast<long>(a[i].tick);
+    }
+  }
+  std::cout << "traces agree on " << common << " ticks";
+  if (a.size() != b.size()) {
+    std::cout << ", " << (a.size() < b.size() ? a_path : b_path) << " ends first";
+  }
+  std::cout << "\n";
+  return -1;
+}
+
+static std::string hex_bytes(const char *bytes, size_t size) {
+  std::ostringstream out;
+  out << "0x" << std::hex;
+  // little-endian raw value, most significant byte first
+  for (size_t i = size; i-- > 0;) {
+    out << (static_cast<unsigned char>(bytes[i]) >> 4) << (static_cast<unsigned char>(bytes[i]) & 15);
+  }
+  return out.str();
+}
+
+// Returns true when the dumps are equal
+static bool compare_dumps(const std::string &a_path, const std::string &b_path) {
+  MappedFile a(a_path), b(b_path);
+  StateDumpHeader ha, hb;
+  for (auto [file, header, path] : {std::tuple{&a, &ha, &a_path}, std::tuple{&b, &hb, &b_path}}) {
+    if (file->size() < sizeof(StateDumpHeader)) {
+      throw std::runtime_error(*path + " is not a state dump");
+    }
+    std::memcpy(header, file->data(), sizeof(StateDumpHeader));
+    size_t cell = 1 + header->p_size + 4 * header->velocity_size;
+    if (header->magic != state_dump_magic || file->size() != sizeof(StateDumpHeader) + cell * header->n * header->m) {
+      throw std::runtime_error(*path + " is not a state dump");
+    }
+  }
+  if (ha.n != hb.n || ha.m != hb.m || ha.p_size != hb.p_size || ha.velocity_size != hb.velocity_size) {
+    std::cout << "dumps differ in size or value types: " << ha.n << "x" << ha.m << " p" << ha.p_size << " v"
+        << ha.velocity_size << " against " << hb.n << "x" << hb.m << " p" << hb.p_size << " v" << hb.velocity_size
+        << "\n";
+    return false;
+  }
+  size_t cell = 1 + ha.p_size + 4 * ha.velocity_size;
+  const char *ca = a.data() + sizeof(StateDumpHeader), *cb = b.data() + sizeof(StateDumpHeader);
+  for (size_t index = 0; index < size_t(ha.n) * ha.m; index++, ca += cell, cb += cell) {
+    if (std::memcmp(ca, cb, cell) == 0) {
+      continue;
+    }
+    std::cout << "first differing cell after " << ha.ticks << " ticks: (" << index / ha.m << ", " << index % ha.m
+        << ")\n";
+    if (ca[0] != cb[0]) {
+      std::cout << "  field '" << ca[0] << "' against '" << cb[0] << "'\n";
+    }
+    if (std::memcmp(ca + 1, cb + 1, ha.p_size) != 0) {
+      std::cout << "  p " << hex_bytes(ca + 1, ha.p_size) << " against " << hex_bytes(cb + 1, ha.p_size) << "\n";
+    }
+    for (size_t i = 0; i < 4; i++) {
+      size_t offset = 1 + ha.p_size + i * ha.velocity_size;
+      if (std::memcmp(ca + offset, cb + offset, ha.velocity_size) != 0) {
+        std::cout << "  velocity[" << i << "] " << hex_bytes(ca + offset, ha.velocity_size) << " against "
+            << hex_bytes(cb + offset, ha.velocity_size) << "\n";
+      }
+    }
+    return false;
+  }
+  std::cout << "dumps after " << ha.ticks << " ticks agree\n";
+  return true;
+}
+
+static bool is_dump(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::array<char, 8> magic{};
+  in.read(magic.data(), magic.size());
+  return in && magic == state_dump_magic;
+}
+
+// Runs both commands at once with `extra` arguments naming a/b, output discarded
+static void run_both(const std::string &a, const std::string &b, const std::string &extra_a,
+                     const std::string &extra_b) {
+  int status_a = 0, status_b = 0;
+  std::thread second([&] { status_b = std::system((b + " " + extra_b + " > /dev/null").c_str()); });
+  status_a = std::system((a + " " + extra_a + " > /dev/null").c_str());
+  second.join();
+  // an engine that aborts still leaves the trace up to its last tick, which is what we compare
+  if (status_a != 0 || status_b != 0) {
+    std::cerr << "note: exit status " << status_a << " and " << status_b << "\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string a_command, b_command, dir = ".";
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--a=", 0) == 0) {
+      a_command = arg.substr(4);
+    } else if (arg.rfind("--b=", 0) == 0) {
+      b_command = arg.substr(4);
+    } else if (arg.rfind("--dir=", 0) == 0) {
+      dir = arg.substr(6);
+    } else {
+      files.push_back(arg);
+    }
+  }
+  bool commands = !a_command.empty() && !b_command.empty();
+  if (commands == (files.size() == 2)) {
+    std::cerr << "Usage: " << argv[0] << " <a.trace> <b.trace> | <a.dump> <b.dump>\n"
+        << "       " << argv[0] << " --a=command --b=command [--dir=path]\n";
+    return 1;
+  }
+
+  try {
+    if (!commands) {
+      if (is_dump(files[0])) {
+        return compare_dumps(files[0], files[1]) ? 0 : 2;
+      }
+      return compare_traces(files[0], files[1]) < 0 ? 0 : 2;
+    }
+    std::string a_trace = dir + "/a.trace", b_trace = dir + "/b.trace";
+    run_both(a_command, b_command, "--trace=" + a_trace, "--trace=" + b_trace);
+    long tick = compare_traces(a_trace, b_trace);
+    if (tick < 0) {
+      return 0;
+    }
+    std::string a_dump = dir + "/a.dump", b_dump = dir + "/b.dump";
+    std::string dump = " --dump-tick=" + std::to_string(tick) + " --ticks=" + std::to_string(tick + 1);
+    run_both(a_command, b_command, "--trace=" + a_trace + " --dump-state=" + a_dump + dump,
+             "--trace=" + b_trace + " --dump-state=" + b_dump + dump);
+    compare_dumps(a_dump, b_dump);
+    return 2;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}